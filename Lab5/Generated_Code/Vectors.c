@@ -62,6 +62,7 @@
 #include "FTM.h"
 #include "I2C.h"
 #include "accel.h"
+#include "Flash.h"
 
   /* ISR prototype */
   extern uint32_t __SP_INIT;
@@ -95,25 +96,25 @@
     (tIsrFunc)&Cpu_Interrupt,          /* 0x0D  0x00000034   -   ivINT_Reserved13               unused by PE */
     (tIsrFunc)&OS_ContextSwitchISR,    /* 0x0E  0x00000038   -   ivINT_PendableSrvReq           unused by PE */
     (tIsrFunc)&OS_SysTickISR,          /* 0x0F  0x0000003C   -   ivINT_SysTick                  unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x10  0x00000040   -   ivINT_DMA0_DMA16               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x11  0x00000044   -   ivINT_DMA1_DMA17               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x12  0x00000048   -   ivINT_DMA2_DMA18               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x13  0x0000004C   -   ivINT_DMA3_DMA19               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x14  0x00000050   -   ivINT_DMA4_DMA20               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x15  0x00000054   -   ivINT_DMA5_DMA21               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x16  0x00000058   -   ivINT_DMA6_DMA22               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x17  0x0000005C   -   ivINT_DMA7_DMA23               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x18  0x00000060   -   ivINT_DMA8_DMA24               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x19  0x00000064   -   ivINT_DMA9_DMA25               unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x1A  0x00000068   -   ivINT_DMA10_DMA26              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x1B  0x0000006C   -   ivINT_DMA11_DMA27              unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x10  0x00000040   -   ivINT_DMA0_DMA16               unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x11  0x00000044   -   ivINT_DMA1_DMA17               unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x12  0x00000048   -   ivINT_DMA2_DMA18               unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x13  0x0000004C   -   ivINT_DMA3_DMA19               unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x14  0x00000050   -   ivINT_DMA4_DMA20               unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x15  0x00000054   -   ivINT_DMA5_DMA21               unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x16  0x00000058   -   ivINT_DMA6_DMA22               unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x17  0x0000005C   -   ivINT_DMA7_DMA23               unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x18  0x00000060   -   ivINT_DMA8_DMA24               unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x19  0x00000064   -   ivINT_DMA9_DMA25               unused by PE */
+    (tIsrFunc)&UART_TxDMA_ISR,         /* 0x1A  0x00000068   -   ivINT_DMA10_DMA26              unused by PE */
+    (tIsrFunc)&UART_RxDMA_ISR,         /* 0x1B  0x0000006C   -   ivINT_DMA11_DMA27              unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x1C  0x00000070   -   ivINT_DMA12_DMA28              unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x1D  0x00000074   -   ivINT_DMA13_DMA29              unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x1E  0x00000078   -   ivINT_DMA14_DMA30              unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x1F  0x0000007C   -   ivINT_DMA15_DMA31              unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x20  0x00000080   -   ivINT_DMA_Error                unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x21  0x00000084   -   ivINT_MCM                      unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x22  0x00000088   -   ivINT_FTFE                     unused by PE */
+    (tIsrFunc)&FTFE_ISR,               /* 0x22  0x00000088   -   ivINT_FTFE                     unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x23  0x0000008C   -   ivINT_Read_Collision           unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x24  0x00000090   -   ivINT_LVD_LVW                  unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x25  0x00000094   -   ivINT_LLW                      unused by PE */
@@ -140,18 +141,18 @@
     (tIsrFunc)&Cpu_Interrupt,          /* 0x3A  0x000000E8   -   ivINT_CAN1_Wake_Up             unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x3B  0x000000EC   -   ivINT_Reserved59               unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x3C  0x000000F0   -   ivINT_UART0_LON                unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x3D  0x000000F4   -   ivINT_UART0_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x3E  0x000000F8   -   ivINT_UART0_ERR                unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x3F  0x000000FC   -   ivINT_UART1_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x40  0x00000100   -   ivINT_UART1_ERR                unused by PE */
+    (tIsrFunc)&UART_ISR,               /* 0x3D  0x000000F4   -   ivINT_UART0_RX_TX              unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x3E  0x000000F8   -   ivINT_UART0_ERR                unused by PE */
+    (tIsrFunc)&UART_ISR,               /* 0x3F  0x000000FC   -   ivINT_UART1_RX_TX              unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x40  0x00000100   -   ivINT_UART1_ERR                unused by PE */
     (tIsrFunc)&UART_ISR,               /* 0x41  0x00000104   -   ivINT_UART2_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x42  0x00000108   -   ivINT_UART2_ERR                unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x43  0x0000010C   -   ivINT_UART3_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x44  0x00000110   -   ivINT_UART3_ERR                unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x45  0x00000114   -   ivINT_UART4_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x46  0x00000118   -   ivINT_UART4_ERR                unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x47  0x0000011C   -   ivINT_UART5_RX_TX              unused by PE */
-    (tIsrFunc)&Cpu_Interrupt,          /* 0x48  0x00000120   -   ivINT_UART5_ERR                unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x42  0x00000108   -   ivINT_UART2_ERR                unused by PE */
+    (tIsrFunc)&UART_ISR,               /* 0x43  0x0000010C   -   ivINT_UART3_RX_TX              unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x44  0x00000110   -   ivINT_UART3_ERR                unused by PE */
+    (tIsrFunc)&UART_ISR,               /* 0x45  0x00000114   -   ivINT_UART4_RX_TX              unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x46  0x00000118   -   ivINT_UART4_ERR                unused by PE */
+    (tIsrFunc)&UART_ISR,               /* 0x47  0x0000011C   -   ivINT_UART5_RX_TX              unused by PE */
+    (tIsrFunc)&UART_ErrorISR,          /* 0x48  0x00000120   -   ivINT_UART5_ERR                unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x49  0x00000124   -   ivINT_ADC0                     unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x4A  0x00000128   -   ivINT_ADC1                     unused by PE */
     (tIsrFunc)&Cpu_Interrupt,          /* 0x4B  0x0000012C   -   ivINT_CMP0                     unused by PE */
@@ -0,0 +1,9 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the Processor Expert CPU header, under the name packet.c includes it by.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#include "Cpu.h"
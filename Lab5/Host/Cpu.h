@@ -0,0 +1,14 @@
+/*! @file
+ *
+ *  @brief Host stand-in for the Processor Expert CPU header.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#define CPU_CORE_CLK_HZ 120000000U
+
+#endif
@@ -0,0 +1,91 @@
+/*! @file
+ *
+ *  @brief Decoder for the delta and run-length compressed telemetry samples.
+ *
+ *  This is the PC side of the Delta module, decoding the nibble stream described in Delta.h.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+// Included header files
+#include "types.h"
+#include "DeltaDecode.h"
+
+// Escape nibble and the nibbles after it, as in Delta.c
+#define DELTA_ESCAPE 0x8
+#define DELTA_LONG_RUN 0xE
+#define DELTA_KEYFRAME 0xF
+
+// Reads the next nibble into the variable, or stops decoding at the end of the buffer
+#define NEXT_NIBBLE(nibble) \
+  do { \
+    if (index >= 2 * (uint32_t)size) \
+      return count; \
+    (nibble) = (index & 1) ? (buffer[index / 2] & 0x0F) : (buffer[index / 2] >> 4); \
+    index++; \
+  } while (0)
+
+// Two's complement value of a nibble
+#define NIBBLE_SIGNED(nibble) ((int8_t)((nibble) << 4) >> 4)
+
+
+uint16_t Delta_Decode(const uint8_t* const buffer, const uint16_t size, uint8_t samples[][3], const uint16_t nbSamples)
+{
+  uint32_t index = 0;   /*!< Next nibble */
+  uint16_t count = 0;   /*!< Number of samples decoded */
+  uint16_t run;         /*!< Number of copies of the previous sample */
+  uint8_t last[3] = {0, 0, 0};
+  BOOL keyed = bFALSE;  /*!< TRUE once a keyframe has given the absolute values */
+  uint8_t nibble, high, axis;
+
+  while (count < nbSamples)
+  {
+    NEXT_NIBBLE(nibble);
+
+    if (nibble != DELTA_ESCAPE) // Delta sample
+    {
+      if (!keyed)
+        return count;
+      last[0] += NIBBLE_SIGNED(nibble);
+      for (axis = 1; axis < 3; axis++)
+      {
+        NEXT_NIBBLE(nibble);
+        last[axis] += NIBBLE_SIGNED(nibble);
+      }
+      run = 1;
+    }
+    else
+    {
+      NEXT_NIBBLE(nibble);
+      if (nibble == DELTA_KEYFRAME) // Absolute values
+      {
+        for (axis = 0; axis < 3; axis++)
+        {
+          NEXT_NIBBLE(high);
+          NEXT_NIBBLE(nibble);
+          last[axis] = (high << 4) | nibble;
+        }
+        keyed = bTRUE;
+        run = 1;
+      }
+      else if (nibble == DELTA_LONG_RUN)
+      {
+        NEXT_NIBBLE(high);
+        NEXT_NIBBLE(nibble);
+        run = ((high << 4) | nibble) + 1;
+      }
+      else
+        run = nibble + 2;
+
+      if (!keyed)
+        return count;
+    }
+
+    for (; run && (count < nbSamples); run--, count++)
+      for (axis = 0; axis < 3; axis++)
+        samples[count][axis] = last[axis];
+  }
+
+  return count;
+}
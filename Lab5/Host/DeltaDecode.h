@@ -0,0 +1,27 @@
+/*! @file
+ *
+ *  @brief Decoder for the delta and run-length compressed telemetry samples.
+ *
+ *  This is the PC side of the Delta module, decoding the nibble stream described in Delta.h.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#ifndef DELTADECODE_H
+#define DELTADECODE_H
+
+// new types
+#include "types.h"
+
+/*! @brief Decodes samples encoded by Delta_Encode.
+ *
+ *  @param buffer The encoded samples, as returned by Delta_Finish.
+ *  @param size The number of bytes.
+ *  @param samples Where the X, Y and Z values of the decoded samples go.
+ *  @param nbSamples The number of samples encoded.
+ *  @return uint16_t - The number of samples decoded, less than nbSamples if the buffer ends early or is malformed.
+ */
+uint16_t Delta_Decode(const uint8_t* const buffer, const uint16_t size, uint8_t samples[][3], const uint16_t nbSamples);
+
+#endif
@@ -0,0 +1,260 @@
+/*! @file
+ *
+ *  @brief Round trip test and benchmark of the Delta module over representative accelerometer traces.
+ *
+ *  The traces are 8-bit samples at 1 g = 64 counts, as the accelerometer returns them in fast read mode:
+ *  lying still with sensor noise, slowly tilted by hand, carried while walking, and knocked about.
+ *  Each trace is cut into stream frames of STREAM_MAX_SAMPLES encoded on their own as main.c does, a frame
+ *  that would not get smaller being sent raw, and is also encoded as one long stream with periodic keyframes.
+ *  Every encoding is decoded again and compared, then the compression ratio and the encoding time are reported.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "types.h"
+#include "Delta.h"
+#include "DeltaDecode.h"
+
+// Number of samples in each trace
+#define TRACE_SIZE 4096
+
+// Samples per stream frame, as in main.c
+#define STREAM_MAX_SAMPLES 64
+
+// Keyframe interval of the long stream
+#define KEY_INTERVAL 32
+
+// Number of times each trace is encoded for the timing
+#define TIMING_PASSES 200
+
+// 1 g in counts
+#define ONE_G 64
+
+// Kinds of trace
+typedef enum
+{
+  TRACE_STILL,
+  TRACE_TILT,
+  TRACE_WALK,
+  TRACE_KNOCK,
+  TRACE_RUNS,
+  NB_TRACES
+} TTrace;
+
+static const char* const TraceName[NB_TRACES] = {"still", "tilt", "walk", "knock", "runs"};
+
+static uint8_t Trace[TRACE_SIZE][3];          /*!< The samples */
+static uint8_t Decoded[TRACE_SIZE][3];        /*!< The samples decoded again */
+static uint8_t Encoded[TRACE_SIZE * 3 + 16];  /*!< Encoded samples */
+
+
+/*! @brief Clips a value to the 8-bit sample range.
+ *
+ *  @param value The value in counts.
+ *  @return uint8_t - The sample, two's complement.
+ */
+static uint8_t Clip(const double value)
+{
+  long rounded = lround(value);
+
+  if (rounded > 127)
+    rounded = 127;
+  else if (rounded < -128)
+    rounded = -128;
+
+  return (uint8_t)(int8_t)rounded;
+}
+
+
+/*! @brief Noise of the least significant bit, zero most of the time.
+ *
+ *  @param percent Chance in percent of a count either way.
+ *  @return int - -1, 0 or 1.
+ */
+static int Noise(const int percent)
+{
+  int r = rand() % 200;
+
+  if (r < percent)
+    return -1;
+  if (r < 2 * percent)
+    return 1;
+  return 0;
+}
+
+
+/*! @brief Fills Trace with samples of one kind.
+ *
+ *  @param trace The kind.
+ */
+static void MakeTrace(const TTrace trace)
+{
+  double x = 0, y = 0, z = ONE_G, angle;
+  int i, axis, run, left = 0;
+
+  for (i = 0; i < TRACE_SIZE; i++)
+  {
+    switch (trace)
+    {
+      case TRACE_STILL: // Flat on the bench
+        x = 1 + Noise(5);
+        y = -2 + Noise(5);
+        z = ONE_G + Noise(5);
+        break;
+      case TRACE_TILT: // Turned slowly about two axes
+        angle = 2 * M_PI * i / 900.0;
+        x = ONE_G * sin(0.8 * sin(angle)) + Noise(20);
+        y = ONE_G * sin(0.5 * cos(0.7 * angle)) + Noise(20);
+        z = sqrt(fmax(0, ONE_G * ONE_G - x * x - y * y)) + Noise(20);
+        break;
+      case TRACE_WALK: // Carried at about two steps a second, sampled at 50 Hz
+        angle = 2 * M_PI * i / 25.0;
+        x = 6 * sin(angle) + 3 * sin(3 * angle) + Noise(30);
+        y = 4 * sin(angle / 2) + Noise(30);
+        z = ONE_G + 14 * sin(angle) * sin(angle) - 7 + Noise(30);
+        break;
+      case TRACE_KNOCK: // Still, with a sharp knock now and then that rings down
+        if (i % 300 == 0)
+          left = 40;
+        x = 1 + (left ? (left * 2.5) * sin(left * 1.7) : 0) + Noise(5);
+        y = -2 + (left ? (left * 1.5) * cos(left * 2.3) : 0) + Noise(5);
+        z = ONE_G + (left ? (left * 3.0) * sin(left * 1.1) : 0) + Noise(5);
+        if (left)
+          left--;
+        break;
+      case TRACE_RUNS: // Runs of every length the encoder treats differently, at every kind of step
+        if (left == 0)
+        {
+          run = (int[]){1, 2, 3, 15, 16, 17, 255, 256, 257, 300, 513}[rand() % 11];
+          left = run;
+          axis = rand() % 3;
+          if (axis == 0)
+            x += (rand() % 2) ? 7 : -9; // Largest delta, and the X difference taken by the escape
+          else if (axis == 1)
+            y += (rand() % 2) ? -8 : 8;
+          else
+            z += (rand() % 41) - 20;
+        }
+        left--;
+        break;
+      default:
+        break;
+    }
+
+    Trace[i][0] = Clip(x);
+    Trace[i][1] = Clip(y);
+    Trace[i][2] = Clip(z);
+  }
+}
+
+
+/*! @brief Encodes part of Trace.
+ *
+ *  @param first The first sample.
+ *  @param nbSamples The number of samples.
+ *  @param size The size of the buffer to encode into.
+ *  @param keyInterval The keyframe interval.
+ *  @return uint16_t - The number of bytes, 0 if they did not fit.
+ */
+static uint16_t Encode(const int first, const int nbSamples, const uint16_t size, const uint16_t keyInterval)
+{
+  TDeltaCodec codec;
+  int i;
+
+  Delta_Init(&codec, Encoded, size, keyInterval);
+  for (i = 0; i < nbSamples; i++)
+    Delta_Encode(&codec, Trace[first + i]);
+
+  return Delta_Finish(&codec);
+}
+
+
+/*! @brief Encodes Trace in stream frames, checks the round trip and reports the results.
+ *
+ *  @param trace The kind of trace.
+ *  @return BOOL - TRUE if every frame and the long stream decoded to the samples encoded.
+ */
+static BOOL Test(const TTrace trace)
+{
+  unsigned long framed = 0, stream, raw = 0;  /*!< Bytes sent */
+  uint16_t length, rawLength;
+  int first, nbSamples, nbCompressed = 0, nbFrames = 0, pass;
+  struct timespec start, end;
+  double nsPerSample;
+
+  MakeTrace(trace);
+
+  for (first = 0; first < TRACE_SIZE; first += nbSamples) // As the streaming thread does
+  {
+    nbSamples = (TRACE_SIZE - first < STREAM_MAX_SAMPLES) ? TRACE_SIZE - first : STREAM_MAX_SAMPLES;
+    rawLength = (uint16_t)(nbSamples * 3);
+    length = Encode(first, nbSamples, rawLength - 1, 0);
+    if (length)
+    {
+      if ((Delta_Decode(Encoded, length, Decoded, (uint16_t)nbSamples) != nbSamples) ||
+          memcmp(Decoded, Trace[first], rawLength))
+      {
+        printf("%s: frame at sample %d does not round trip\n", TraceName[trace], first);
+        return bFALSE;
+      }
+      nbCompressed++;
+    }
+    framed += length ? length : rawLength;
+    raw += rawLength;
+    nbFrames++;
+  }
+
+  stream = Encode(0, TRACE_SIZE, sizeof(Encoded), KEY_INTERVAL);
+  if (!stream || (Delta_Decode(Encoded, (uint16_t)stream, Decoded, TRACE_SIZE) != TRACE_SIZE) ||
+      memcmp(Decoded, Trace, sizeof(Trace)))
+  {
+    printf("%s: stream does not round trip\n", TraceName[trace]);
+    return bFALSE;
+  }
+
+  if (Delta_Decode(Encoded, (uint16_t)(stream / 2), Decoded, TRACE_SIZE) >= TRACE_SIZE) // Truncated
+  {
+    printf("%s: truncated stream decoded in full\n", TraceName[trace]);
+    return bFALSE;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (pass = 0; pass < TIMING_PASSES; pass++)
+    Encode(0, TRACE_SIZE, sizeof(Encoded), KEY_INTERVAL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  nsPerSample = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)TIMING_PASSES * TRACE_SIZE);
+
+  printf("%-6s frames %3d/%3d compressed, %5.1f%% of raw; stream %5.1f%% of raw, %4.2f bytes/sample, %5.1f ns/sample\n",
+         TraceName[trace], nbCompressed, nbFrames, 100.0 * framed / raw, 100.0 * stream / raw, (double)stream / TRACE_SIZE, nsPerSample);
+
+  return bTRUE;
+}
+
+
+int main(void)
+{
+  TTrace trace;
+  BOOL success = bTRUE;
+
+  srand(1);
+
+  for (trace = 0; trace < NB_TRACES; trace++)
+    success = Test(trace) && success;
+
+  MakeTrace(TRACE_WALK);
+  if (Encode(0, STREAM_MAX_SAMPLES, 8, 0) != 0) // Must report the overflow rather than a partial frame
+  {
+    printf("overflow not reported\n");
+    success = bFALSE;
+  }
+
+  printf("delta %s\n", success ? "ok" : "FAILED");
+  return success ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/*! @file
+ *
+ *  @brief Microbenchmark of the single producer, single consumer FIFO against the FIFO it replaced.
+ *
+ *  The earlier FIFO kept a byte count written by both sides, wrapped its indices with a compare, and signalled a
+ *  semaphore on every put and every get. A copy of it is kept here as OldFIFO for the comparison.
+ *  Each pattern moves the same bytes through a FIFO, as a receive interrupt and the thread reading the data do,
+ *  checks that they come out in order, and reports the time and the number of semaphore signals per byte.
+ *  The semaphores never block on the host, so the signal counts show the RTOS calls the target is spared.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "types.h"
+#include "OS.h"
+#include "FIFO.h"
+
+// Number of bytes moved by each pattern
+#define NB_BYTES (16u * 1024u * 1024u)
+
+// Bytes per burst, about a packet received between two reads
+#define BURST 64
+
+// Keeps the earlier FIFO out of line, like FIFO.c which is compiled separately
+#define NOINLINE __attribute__ ((noinline))
+
+// The FIFO before the single producer, single consumer rewrite
+typedef struct
+{
+  uint16_t Start;             /*!< The index of the position of the oldest data in the FIFO */
+  uint16_t End;               /*!< The index of the next available empty position in the FIFO */
+  uint16_t volatile NbBytes;  /*!< The number of bytes currently stored in the FIFO */
+  uint8_t Buffer[FIFO_SIZE];  /*!< The actual array of bytes to store the data */
+  OS_ECB *NotEmptySemaphore;
+  OS_ECB *NotFullSemaphore;
+} TOldFIFO;
+
+// Ways of moving the bytes
+typedef enum
+{
+  PATTERN_BYTE,   /*!< One byte in, one byte out */
+  PATTERN_BURST,  /*!< A burst in one byte at a time, then out one byte at a time */
+  PATTERN_BULK,   /*!< A burst in with one FIFO_PutN, then out with one FIFO_GetN */
+  NB_PATTERNS
+} TPattern;
+
+static const char* const PatternName[NB_PATTERNS] = {"byte", "burst", "bulk"};
+
+
+static void OldFIFO_Init(TOldFIFO* const FIFO)
+{
+  FIFO->NbBytes = 0;
+  FIFO->Start = 0;
+  FIFO->End = 0;
+  FIFO->NotFullSemaphore = OS_SemaphoreCreate(0);
+  FIFO->NotEmptySemaphore = OS_SemaphoreCreate(0);
+}
+
+
+static BOOL NOINLINE OldFIFO_Put(TOldFIFO* const FIFO, const uint8_t data)
+{
+  if (FIFO->NbBytes == FIFO_SIZE)
+  {
+    OS_SemaphoreWait(FIFO->NotFullSemaphore, 0);
+    return bFALSE;
+  }
+
+  FIFO->Buffer[FIFO->End] = data;
+  if (FIFO->End == FIFO_SIZE - 1)
+    FIFO->End = 0;
+  else
+    FIFO->End++;
+  FIFO->NbBytes++;
+  OS_SemaphoreSignal(FIFO->NotEmptySemaphore);
+  return bTRUE;
+}
+
+
+static BOOL NOINLINE OldFIFO_Get(TOldFIFO* const FIFO, uint8_t* const dataPtr)
+{
+  if (FIFO->NbBytes == 0)
+  {
+    OS_SemaphoreWait(FIFO->NotEmptySemaphore, 0);
+    return bFALSE;
+  }
+
+  *dataPtr = FIFO->Buffer[FIFO->Start];
+  if (FIFO->Start == FIFO_SIZE - 1)
+    FIFO->Start = 0;
+  else
+    FIFO->Start++;
+  FIFO->NbBytes--;
+  OS_SemaphoreSignal(FIFO->NotFullSemaphore);
+  return bTRUE;
+}
+
+
+/*! @brief Time since an earlier call.
+ *
+ *  @param start Set to the current time.
+ *  @return double - Nanoseconds since the time in start, before it is set.
+ */
+static double Lap(struct timespec* const start)
+{
+  struct timespec now;
+  double ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ns = (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+  *start = now;
+  return ns;
+}
+
+
+/*! @brief Moves NB_BYTES through the earlier FIFO.
+ *
+ *  @param pattern PATTERN_BYTE or PATTERN_BURST.
+ *  @param signals Set to the number of semaphore signals.
+ *  @return BOOL - TRUE if the bytes came out in order.
+ */
+static BOOL OldRun(const TPattern pattern, uint32_t* const signals)
+{
+  static TOldFIFO fifo;
+  uint32_t in = 0, out = 0;
+  uint8_t data;
+  int i, burst = (pattern == PATTERN_BYTE) ? 1 : BURST;
+
+  OldFIFO_Init(&fifo);
+  while (out < NB_BYTES)
+  {
+    for (i = 0; i < burst; i++)
+      OldFIFO_Put(&fifo, (uint8_t)in++);
+    for (i = 0; i < burst; i++)
+      if (!OldFIFO_Get(&fifo, &data) || (data != (uint8_t)out++))
+        return bFALSE;
+  }
+
+  *signals = fifo.NotEmptySemaphore->Count + fifo.NotFullSemaphore->Count;
+  return bTRUE;
+}
+
+
+/*! @brief Moves NB_BYTES through the single producer, single consumer FIFO.
+ *
+ *  @param pattern The way of moving the bytes.
+ *  @param signals Set to the number of semaphore signals.
+ *  @return BOOL - TRUE if the bytes came out in order.
+ */
+static BOOL NewRun(const TPattern pattern, uint32_t* const signals)
+{
+  static TFIFO fifo;
+  uint8_t block[BURST];
+  uint32_t in = 0, out = 0;
+  uint8_t data;
+  int i, burst = (pattern == PATTERN_BYTE) ? 1 : BURST;
+
+  FIFO_Init(&fifo);
+  while (out < NB_BYTES)
+  {
+    if (pattern == PATTERN_BULK)
+    {
+      for (i = 0; i < burst; i++)
+        block[i] = (uint8_t)in++;
+      if (FIFO_PutN(&fifo, block, BURST) != BURST)
+        return bFALSE;
+      if (FIFO_GetN(&fifo, block, BURST) != BURST)
+        return bFALSE;
+      for (i = 0; i < burst; i++)
+        if (block[i] != (uint8_t)out++)
+          return bFALSE;
+    }
+    else
+    {
+      for (i = 0; i < burst; i++)
+        FIFO_Put(&fifo, (uint8_t)in++);
+      for (i = 0; i < burst; i++)
+        if (!FIFO_Get(&fifo, &data) || (data != (uint8_t)out++))
+          return bFALSE;
+    }
+  }
+
+  *signals = fifo.NotEmptySemaphore->Count + fifo.NotFullSemaphore->Count;
+  return bTRUE;
+}
+
+
+int main(void)
+{
+  struct timespec start = {0, 0};
+  uint32_t signals = 0;
+  double ns;
+  TPattern pattern;
+  BOOL success = bTRUE;
+
+  for (pattern = 0; pattern < NB_PATTERNS; pattern++)
+  {
+    if (pattern != PATTERN_BULK) // The earlier FIFO had no bulk calls
+    {
+      Lap(&start);
+      if (!OldRun(pattern, &signals))
+      {
+        printf("old %s: bytes out of order\n", PatternName[pattern]);
+        success = bFALSE;
+      }
+      ns = Lap(&start);
+      printf("old  %-5s %6.2f ns/byte, %4.2f signals/byte\n", PatternName[pattern], ns / NB_BYTES, (double)signals / NB_BYTES);
+    }
+
+    Lap(&start);
+    if (!NewRun(pattern, &signals))
+    {
+      printf("spsc %s: bytes out of order\n", PatternName[pattern]);
+      success = bFALSE;
+    }
+    ns = Lap(&start);
+    printf("spsc %-5s %6.2f ns/byte, %4.2f signals/byte\n", PatternName[pattern], ns / NB_BYTES, (double)signals / NB_BYTES);
+
+    if (signals) // Nobody waits here, so the fast path must not touch the semaphores
+    {
+      printf("spsc %s: semaphore signalled with nobody waiting\n", PatternName[pattern]);
+      success = bFALSE;
+    }
+  }
+
+  printf("fifo %s\n", success ? "ok" : "FAILED");
+  return success ? 0 : 1;
+}
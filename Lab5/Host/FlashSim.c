@@ -0,0 +1,323 @@
+/*! @file
+ *
+ *  @brief Host simulation of the FTFE flash controller, running the real Flash module.
+ *
+ *  Program flash block 1 is a file mapped at its K70 address, so the variables survive from one run to the next
+ *  like they do across a reset. Writing 0x80 to FSTAT carries out the command in the FCCOB registers:
+ *  Program Phrase, Erase Sector and Program Section from the FlexRAM. Programming a phrase that is not erased
+ *  stops the run, and a command can be torn part way through to check that the log recovers on the next start.
+ *
+ *  Usage:
+ *  - flashsim write <count> [tear]  writes the variables count times, optionally tearing command number tear;
+ *  - flashsim check <number>        starts up and checks the tower number variable;
+ *  - flashsim bulk                  programs blocks of several sizes with Flash_ProgramBlock;
+ *  - flashsim bench                 runs the programming benchmark command handler;
+ *  - flashsim erase                 erases the variables and writes another one.
+ *  Exits with 0 on success, 1 on a failed check, 2 on a controller misuse and 3 after a tear.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "MK70F12.h"
+#include "Cmd.h"
+#include "packet.h"
+#include "Flash.h"
+
+// File holding the image of the simulated flash
+#define IMAGE_FILE "flash.bin"
+
+// Simulated program flash, the non-volatile variables and the benchmark sectors
+#define SIM_FLASH_START FLASH_DATA_START
+#define SIM_FLASH_SIZE 0x4000u
+
+// FlexRAM, the section program buffer
+#define SIM_FLEXRAM_START 0x14000000u
+#define SIM_FLEXRAM_SIZE 0x4000u
+
+// FSTAT while idle, with RDCOLERR set so that a write of CCIF to launch a command can be told apart
+#define STATUS_IDLE (FTFE_FSTAT_CCIF_MASK | 0x40u)
+
+// Registers
+volatile uint8_t FlashSim_FCCOB[12];
+volatile uint8_t FlashSim_FCNFG = FTFE_FCNFG_RAMRDY_MASK;
+volatile uint32_t NVICICPR0, NVICISER0;
+volatile uint32_t DWT_CYCCNT;
+
+static volatile uint8_t Status = STATUS_IDLE;         /*!< FSTAT as read, or as last written by the module */
+static uint8_t *Image;                                 /*!< The simulated flash */
+static long NbCommands;                                /*!< Number of commands carried out */
+static long NbSections;                                /*!< Number of Program Section commands */
+static long TearAt = -1;                               /*!< Command number to tear, -1 for none */
+static TCmdHandler BenchHandler;                       /*!< The handler registered by Flash_Init */
+
+// The variables written by the tests
+static volatile uint16union_t *Number, *Mode;
+static volatile uint8_t *User, *Calibration;
+static volatile uint32_t *Legacy;
+
+
+BOOL Cmd_Register(const uint8_t command, const TCmdHandler handler)
+{
+  (void)command;
+  BenchHandler = handler;
+  return bTRUE;
+}
+
+
+BOOL Packet_PutExtended(const uint8_t command, const uint8_t* const payload, const uint16_t length)
+{
+  (void)payload;
+  printf("reply %02x, %u bytes\n", command, length);
+  return bTRUE;
+}
+
+
+/*! @brief Stops the run after a misuse of the controller.
+ *
+ *  @param message What was wrong.
+ *  @param address The flash address involved.
+ */
+static void Misuse(const char* const message, const uint32_t address)
+{
+  printf("%s at %05x\n", message, (unsigned)address);
+  exit(2);
+}
+
+
+/*! @brief Carries out the command in the FCCOB registers.
+ */
+static void Execute(void)
+{
+  uint32_t address = ((uint32_t)FlashSim_FCCOB[1] << 16) | ((uint32_t)FlashSim_FCCOB[2] << 8) | FlashSim_FCCOB[3];
+  uint8_t *target = &Image[address - SIM_FLASH_START];
+  uint32_t nbBytes, i;
+  BOOL tear = (++NbCommands == TearAt);
+
+  switch (FlashSim_FCCOB[0])
+  {
+    case FLASH_CMD_PROGRAM_PHRASE:
+      nbBytes = 8;
+      break;
+    case FLASH_CMD_ERASE_SECTOR:
+      if ((address & (FLASH_SECTOR_SIZE - 1)) || (address < SIM_FLASH_START) || (address >= SIM_FLASH_START + SIM_FLASH_SIZE))
+        Misuse("bad erase", address);
+      memset(target, 0xFF, tear ? 100 : FLASH_SECTOR_SIZE);
+      if (tear)
+      {
+        printf("torn erase, command %ld\n", NbCommands);
+        exit(3);
+      }
+      return;
+    case 0x0B: // Program Section
+      nbBytes = (((uint32_t)FlashSim_FCCOB[4] << 8) | FlashSim_FCCOB[5]) * 8;
+      if ((address & 15) || (nbBytes > SIM_FLEXRAM_SIZE))
+        Misuse("bad section", address);
+      NbSections++;
+      break;
+    default:
+      Misuse("unknown command", address);
+      return;
+  }
+
+  if ((address & 7) || (address < SIM_FLASH_START) || (address + nbBytes > SIM_FLASH_START + SIM_FLASH_SIZE))
+    Misuse("bad program", address);
+
+  for (i = 0; i < nbBytes; i++)
+    if (target[i] != 0xFF)
+      Misuse("programmed twice", address + i);
+
+  for (i = 0; i < nbBytes; i++)
+  {
+    if (tear && (i == 3)) // Power lost with part of the phrase programmed
+    {
+      printf("torn program, command %ld\n", NbCommands);
+      exit(3);
+    }
+    if (FlashSim_FCCOB[0] == FLASH_CMD_PROGRAM_PHRASE)
+      target[i] = FlashSim_FCCOB[4 + (i & 4) + 3 - (i & 3)]; // FCCOB4-7 hold bytes 3 to 0, FCCOB8-B bytes 7 to 4
+    else
+      target[i] = ((uint8_t* )SIM_FLEXRAM_START)[i];
+  }
+}
+
+
+volatile uint8_t* FlashSim_Status(void)
+{
+  DWT_CYCCNT += 1000; // Commands take time, so the benchmark rates stay finite
+
+  if (Status == FTFE_FSTAT_CCIF_MASK) // Written by the module, launch the command
+    Execute();
+
+  Status = STATUS_IDLE; // Commands complete at once, without errors
+  return &Status;
+}
+
+
+/*! @brief Starts up the Flash module and allocates the variables, as main does after a reset.
+ */
+static void Boot(void)
+{
+  if (!Flash_Init() ||
+      !Flash_Allocate(1, 2, 2, (volatile void** )&Number) ||
+      !Flash_Allocate(2, 2, 2, (volatile void** )&Mode) ||
+      !Flash_Allocate(3, 8, 1, (volatile void** )&User) ||
+      !Flash_Allocate(4, 100, 8, (volatile void** )&Calibration) ||
+      !Flash_AllocateVar((volatile void** )&Legacy, 4))
+  {
+    printf("start up failed\n");
+    exit(1);
+  }
+
+  if ((uintptr_t)Calibration & 7)
+  {
+    printf("calibration misaligned\n");
+    exit(1);
+  }
+}
+
+
+/*! @brief Writes the variables, committing every fifth time, and reads them back.
+ *
+ *  @param count The number of times.
+ *  @return BOOL - TRUE if every write, commit and read back succeeded.
+ */
+static BOOL Write(const int count)
+{
+  uint8_t block[100];
+  int i, k;
+
+  for (i = 0; i < count; i++)
+  {
+    if (!Flash_Write16(&Number->l, (uint16_t)i) || !Flash_Write8(&User[i % 8], (uint8_t)i) || !Flash_Write32(Legacy, 0x12340000u + i))
+      return bFALSE;
+
+    if (i % 10 == 0)
+    {
+      for (k = 0; k < 100; k++)
+        block[k] = (uint8_t)(i + k);
+      if (!Flash_Write(Calibration, block, sizeof(block)))
+        return bFALSE;
+    }
+
+    if ((i % 7 == 0) && !Flash_Write8(&Calibration[50], 0xAA))
+      return bFALSE;
+
+    if ((i % 5 == 0) && !Flash_Commit())
+      return bFALSE;
+
+    if ((Number->l != (uint16_t)i) || (User[i % 8] != (uint8_t)i) || (*Legacy != 0x12340000u + i))
+      return bFALSE;
+  }
+
+  if (Flash_Write(&Calibration[99], block, 2)) // Past the end of the variable
+    return bFALSE;
+
+  return Flash_Commit();
+}
+
+
+/*! @brief Programs blocks of several sizes and alignments and reads them back.
+ *
+ *  @return BOOL - TRUE if every block was programmed as given, and the non-volatile variables were refused.
+ */
+static BOOL Bulk(void)
+{
+  static const uint32_t sizes[] = {5000, 8, 3, 16, 4096, 8184};
+  static uint8_t source[9000];
+  uint32_t address, i, k;
+
+  for (i = 0; i < sizeof(source); i++)
+    source[i] = (uint8_t)rand();
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    address = SIM_FLASH_START + 0x2000 + (i % 2) * 8;
+    if (!Flash_EraseRange(SIM_FLASH_START + 0x2000, 0x2000) || !Flash_ProgramBlock(address, source, sizes[i]) ||
+        memcmp((const void* )(uintptr_t)address, source, sizes[i]))
+      return bFALSE;
+
+    for (k = sizes[i]; k < ((sizes[i] + 7) & ~7u); k++) // Padding of the last phrase stays erased
+      if (_FB(address + k) != 0xFF)
+        return bFALSE;
+  }
+
+  return !Flash_ProgramBlock(SIM_FLASH_START, source, 8) && !Flash_EraseRange(SIM_FLASH_START + FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE) &&
+         !Flash_ProgramBlock(0x1000, source, 8);
+}
+
+
+int main(int argc, char** argv)
+{
+  int file;
+  BOOL success = bFALSE;
+
+  if (argc < 2)
+  {
+    printf("usage: flashsim write <count> [tear] | check <number> | bulk | bench | erase\n");
+    return 1;
+  }
+
+  file = open(IMAGE_FILE, O_RDWR | O_CREAT, 0644);
+  if ((file < 0) || (lseek(file, 0, SEEK_END) < (off_t)SIM_FLASH_SIZE))
+  {
+    static uint8_t erased[SIM_FLASH_SIZE];
+
+    memset(erased, 0xFF, sizeof(erased));
+    if ((file < 0) || (pwrite(file, erased, sizeof(erased), 0) != (ssize_t)sizeof(erased)))
+    {
+      perror(IMAGE_FILE);
+      return 1;
+    }
+  }
+
+  Image = mmap((void* )SIM_FLASH_START, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0);
+  if ((Image != (void* )SIM_FLASH_START) ||
+      (mmap((void* )SIM_FLEXRAM_START, SIM_FLEXRAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != (void* )SIM_FLEXRAM_START))
+  {
+    perror("mmap");
+    return 1;
+  }
+
+  if (!strcmp(argv[1], "write") && (argc > 2))
+  {
+    if (argc > 3)
+      TearAt = atol(argv[3]);
+    Boot();
+    success = Write(atoi(argv[2]));
+    printf("write: %ld commands\n", NbCommands);
+  }
+  else if (!strcmp(argv[1], "check") && (argc > 2))
+  {
+    Boot();
+    success = (Number->l == (uint16_t)atoi(argv[2]));
+    printf("check: number %u\n", Number->l);
+  }
+  else if (!strcmp(argv[1], "bulk"))
+  {
+    Boot();
+    success = Bulk();
+  }
+  else if (!strcmp(argv[1], "bench"))
+  {
+    Boot();
+    success = BenchHandler && BenchHandler() && (NbSections == 1);
+    printf("bench: %ld commands, %ld sections\n", NbCommands, NbSections);
+  }
+  else if (!strcmp(argv[1], "erase"))
+  {
+    Boot();
+    success = Flash_Erase() && (Number->l == 0xFFFF) && Flash_Write16(&Mode->l, 7) && Flash_Commit();
+  }
+
+  printf("%s %s\n", argv[1], success ? "ok" : "FAILED");
+  return success ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+/*! @file
+ *
+ *  @brief Host stand-ins for the MK70F12 peripheral registers used by the modules under test.
+ *
+ *  The FTFE status register is read through FlashSim_Status, which carries out the command written to the FCCOB registers.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+// FTFE
+extern volatile uint8_t FlashSim_FCCOB[12];
+extern volatile uint8_t FlashSim_FCNFG;
+volatile uint8_t* FlashSim_Status(void);
+
+#define FTFE_FSTAT (*FlashSim_Status())
+#define FTFE_FSTAT_CCIF_MASK 0x80u
+#define FTFE_FSTAT_ACCERR_MASK 0x20u
+#define FTFE_FSTAT_FPVIOL_MASK 0x10u
+#define FTFE_FSTAT_MGSTAT0_MASK 0x01u
+#define FTFE_FCCOB0 FlashSim_FCCOB[0]
+#define FTFE_FCCOB1 FlashSim_FCCOB[1]
+#define FTFE_FCCOB2 FlashSim_FCCOB[2]
+#define FTFE_FCCOB3 FlashSim_FCCOB[3]
+#define FTFE_FCCOB4 FlashSim_FCCOB[4]
+#define FTFE_FCCOB5 FlashSim_FCCOB[5]
+#define FTFE_FCCOB6 FlashSim_FCCOB[6]
+#define FTFE_FCCOB7 FlashSim_FCCOB[7]
+#define FTFE_FCCOB8 FlashSim_FCCOB[8]
+#define FTFE_FCCOB9 FlashSim_FCCOB[9]
+#define FTFE_FCCOBA FlashSim_FCCOB[10]
+#define FTFE_FCCOBB FlashSim_FCCOB[11]
+#define FTFE_FCCOB0_CCOBn(x) (x)
+#define FTFE_FCNFG FlashSim_FCNFG
+#define FTFE_FCNFG_CCIE_MASK 0x80u
+#define FTFE_FCNFG_RAMRDY_MASK 0x02u
+
+// NVIC
+extern volatile uint32_t NVICICPR0, NVICISER0;
+#define NVIC_ICPR_CLRPEND(x) (x)
+#define NVIC_ISER_SETENA(x) (x)
+
+// DWT
+extern volatile uint32_t DWT_CYCCNT;
+
+#endif
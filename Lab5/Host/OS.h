@@ -0,0 +1,58 @@
+/*! @file
+ *
+ *  @brief Host stand-ins for the RTOS calls used by the modules under test.
+ *
+ *  The tests are single threaded, so semaphores never block and delays return at once.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#ifndef OS_H
+#define OS_H
+
+#include <stdint.h>
+
+typedef struct
+{
+  uint32_t Count; /*!< Number of signals not yet waited for */
+} OS_ECB;
+
+static inline OS_ECB* OS_SemaphoreCreate(const uint16_t count)
+{
+  static OS_ECB semaphores[8];
+  static uint8_t next;
+  OS_ECB *semaphore = &semaphores[next++ % 8];
+
+  semaphore->Count = count;
+  return semaphore;
+}
+
+static inline uint8_t OS_SemaphoreWait(OS_ECB* const semaphore, const uint32_t timeout)
+{
+  (void)timeout;
+  if (semaphore->Count)
+    semaphore->Count--;
+  return 0;
+}
+
+static inline uint8_t OS_SemaphoreSignal(OS_ECB* const semaphore)
+{
+  semaphore->Count++;
+  return 0;
+}
+
+static inline void OS_TimeDelay(const uint32_t ticks)
+{
+  (void)ticks;
+}
+
+static inline void OS_ISREnter(void)
+{
+}
+
+static inline void OS_ISRExit(void)
+{
+}
+
+#endif
@@ -0,0 +1,15 @@
+/*! @file
+ *
+ *  @brief Host stand-ins for the Processor Expert critical section macros.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#ifndef PE_TYPES_H
+#define PE_TYPES_H
+
+#define EnterCritical() do {} while (0)
+#define ExitCritical() do {} while (0)
+
+#endif
@@ -0,0 +1,351 @@
+/*! @file
+ *
+ *  @brief Fuzz test and benchmark of the packet framer's resynchronization.
+ *
+ *  A stream of plain and extended packets is corrupted at several rates, with random bytes replacing
+ *  bytes of the packets and bursts of line noise between them, and fed to Packet_Get through a stand-in UART.
+ *  The packets that come out are matched in order against the ones sent. Without corruption every packet must come
+ *  out and nothing else; with corruption most packets left intact must still be found. A stream of nothing but
+ *  noise gives the worst case rate of the framer in bytes per second.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-12
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "packet.h"
+#include "UART.h"
+#include "CRC.h"
+#include "Cmd.h"
+
+// Number of packets sent at each corruption rate
+#define NB_PACKETS 50000
+
+// Largest payload of the extended packets sent, kept small so that the stream is mostly headers
+#define MAX_TEST_PAYLOAD 64
+
+// Largest stream, enough for the packets with noise between them
+#define STREAM_SIZE (16u * 1024u * 1024u)
+
+// How far ahead of the next expected packet a received packet is looked for
+#define LOOKAHEAD 16
+
+// One packet sent
+typedef struct
+{
+  uint8_t Header[PACKET_NB_BYTES];       /*!< The plain packet, or the header of an extended one */
+  uint16_t Length;                       /*!< Payload length, 0 for a plain packet */
+  uint8_t Payload[MAX_TEST_PAYLOAD];     /*!< The payload */
+  BOOL Intact;                           /*!< TRUE if none of its bytes were corrupted */
+} TSent;
+
+TPacket Packet;
+
+static TSent Sent[NB_PACKETS];           /*!< The packets in the stream */
+static uint8_t Stream[STREAM_SIZE];      /*!< The bytes on the line */
+static uint32_t StreamLength;            /*!< Number of bytes in the stream */
+static uint32_t StreamIndex;             /*!< Next byte the UART returns */
+
+
+BOOL UART_Init(const TUARTInstance instance, const uint32_t baudRate, const uint32_t moduleClk, const uint8_t threadPriority)
+{
+  (void)instance; (void)baudRate; (void)moduleClk; (void)threadPriority;
+  return bTRUE;
+}
+
+
+uint16_t UART_InChars(const TUARTInstance instance, uint8_t* const data, const uint16_t nbBytes)
+{
+  uint16_t count = 0;
+
+  (void)instance;
+  while ((count < nbBytes) && (StreamIndex < StreamLength))
+    data[count++] = Stream[StreamIndex++];
+  return count;
+}
+
+
+uint32_t UART_RxTimestamp(const TUARTInstance instance)
+{
+  (void)instance;
+  return StreamIndex; // One period per byte, the timeout is off anyway
+}
+
+
+uint32_t UART_LineErrors(const TUARTInstance instance)
+{
+  (void)instance;
+  return 0; // Corruption the UART does not notice, the framer's own checks are under test
+}
+
+
+void UART_WaitForData(const TUARTInstance instance)
+{
+  (void)instance;
+}
+
+
+void UART_SetRxWakeLevel(const TUARTInstance instance, const uint16_t wakeLevel)
+{
+  (void)instance; (void)wakeLevel;
+}
+
+
+void UART_GetStats(const TUARTInstance instance, TUARTStats* const stats)
+{
+  (void)instance;
+  memset(stats, 0, sizeof(*stats));
+}
+
+
+void UART_OutChars(const TUARTInstance instance, const uint8_t* const data, const uint16_t nbBytes)
+{
+  (void)instance; (void)data; (void)nbBytes;
+}
+
+
+void UART_OutLane(const TUARTInstance instance, const TUARTLane lane, const uint8_t* const data, const uint16_t nbBytes, const BOOL endOfFrame)
+{
+  (void)instance; (void)lane; (void)data; (void)nbBytes; (void)endOfFrame;
+}
+
+
+void UART_OutBlock(const TUARTInstance instance, const uint8_t* const data, const uint32_t nbBytes)
+{
+  (void)instance; (void)data; (void)nbBytes;
+}
+
+
+BOOL CRC_Init(void)
+{
+  return bTRUE;
+}
+
+
+uint16_t CRC_Calculate(const uint16_t seed, const uint8_t* const data, const uint16_t length)
+{
+  uint16_t crc = seed;
+  uint16_t i;
+  uint8_t bit;
+
+  for (i = 0; i < length; i++) // CRC-16/CCITT, as the CRC module computes it
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+
+  return crc;
+}
+
+
+BOOL Cmd_Register(const uint8_t command, const TCmdHandler handler)
+{
+  (void)command; (void)handler;
+  return bTRUE;
+}
+
+
+/*! @brief Chance of an event.
+ *
+ *  @param perMillion The probability in parts per million.
+ *  @return BOOL - TRUE if the event happens.
+ */
+static BOOL Chance(const uint32_t perMillion)
+{
+  return ((uint32_t)rand() % 1000000u) < perMillion;
+}
+
+
+/*! @brief Appends a byte to the stream, corrupting it at the given rate.
+ *
+ *  @param data The byte sent.
+ *  @param perMillion The corruption rate in parts per million.
+ *  @return BOOL - TRUE if the byte arrived as sent.
+ */
+static BOOL Append(const uint8_t data, const uint32_t perMillion)
+{
+  uint8_t received = data;
+
+  if (Chance(perMillion))
+    received = (uint8_t)(data ^ (1 + rand() % 255)); // Always a different byte
+
+  Stream[StreamLength++] = received;
+  return (received == data);
+}
+
+
+/*! @brief Fills Stream with NB_PACKETS packets, one in eight extended, corrupted at a rate.
+ *
+ *  @param perMillion The corruption rate in parts per million: the chance of a byte being replaced,
+ *         and ten times the chance of a burst of up to 16 bytes of noise before a packet.
+ */
+static void MakeStream(const uint32_t perMillion)
+{
+  TSent *sent;
+  uint16_t crc;
+  int i, k, noise;
+
+  StreamLength = 0;
+  StreamIndex = 0;
+
+  for (i = 0; i < NB_PACKETS; i++)
+  {
+    sent = &Sent[i];
+
+    if (Chance(10 * perMillion))
+      for (noise = 1 + rand() % 16; noise; noise--)
+        Stream[StreamLength++] = (uint8_t)rand();
+
+    sent->Length = (rand() % 8) ? 0 : (uint16_t)(1 + rand() % MAX_TEST_PAYLOAD);
+    if (sent->Length)
+    {
+      sent->Header[0] = PACKET_EXTENDED;
+      sent->Header[1] = (uint8_t)rand();
+      sent->Header[2] = (uint8_t)sent->Length;
+      sent->Header[3] = (uint8_t)(sent->Length >> 8);
+      for (k = 0; k < sent->Length; k++)
+        sent->Payload[k] = (uint8_t)rand();
+    }
+    else
+    {
+      do
+        sent->Header[0] = (uint8_t)rand();
+      while (sent->Header[0] == PACKET_EXTENDED);
+      for (k = 1; k < 4; k++)
+        sent->Header[k] = (uint8_t)rand();
+    }
+    sent->Header[4] = sent->Header[0] ^ sent->Header[1] ^ sent->Header[2] ^ sent->Header[3];
+
+    sent->Intact = bTRUE;
+    for (k = 0; k < PACKET_NB_BYTES; k++)
+      sent->Intact = Append(sent->Header[k], perMillion) && sent->Intact;
+
+    if (sent->Length)
+    {
+      crc = CRC_Calculate(CRC_Calculate(CRC_SEED, sent->Header, PACKET_NB_BYTES), sent->Payload, sent->Length);
+      for (k = 0; k < sent->Length; k++)
+        sent->Intact = Append(sent->Payload[k], perMillion) && sent->Intact;
+      sent->Intact = Append((uint8_t)crc, perMillion) && sent->Intact;
+      sent->Intact = Append((uint8_t)(crc >> 8), perMillion) && sent->Intact;
+    }
+  }
+}
+
+
+/*! @brief Checks whether the packet received is a packet sent.
+ *
+ *  @param sent The packet sent.
+ *  @return BOOL - TRUE if the command, parameters and any payload match.
+ */
+static BOOL Matches(const TSent* const sent)
+{
+  if (sent->Length)
+    return (Packet_Length == sent->Length) && (Packet_Command == sent->Header[1]) &&
+           !memcmp(Packet_Payload, sent->Payload, sent->Length);
+
+  return (Packet_Length == 0) && !memcmp(Packet.bytes, sent->Header, PACKET_NB_BYTES);
+}
+
+
+/*! @brief Runs the framer over Stream and matches what comes out against Sent.
+ *
+ *  @param nbSent The number of packets in Sent, 0 if the stream is noise.
+ *  @param found Set to the number of packets sent that were received.
+ *  @param intactFound Set to the number of those that were sent intact.
+ *  @param spurious Set to the number of packets received that were not sent.
+ *  @return double - The framer's rate in bytes per second.
+ */
+static double Run(const int nbSent, int* const found, int* const intactFound, int* const spurious)
+{
+  struct timespec start, end;
+  int next = 0, j;
+
+  *found = 0;
+  *intactFound = 0;
+  *spurious = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (StreamIndex < StreamLength)
+  {
+    if (!Packet_Get())
+      continue;
+
+    for (j = next; (j < nbSent) && (j < next + LOOKAHEAD); j++)
+      if (Matches(&Sent[j]))
+        break;
+
+    if ((j < nbSent) && (j < next + LOOKAHEAD))
+    {
+      (*found)++;
+      if (Sent[j].Intact)
+        (*intactFound)++;
+      next = j + 1;
+    }
+    else
+      (*spurious)++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return StreamLength / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+}
+
+
+int main(void)
+{
+  static const uint32_t rates[] = {0, 100, 1000, 10000, 50000}; /*!< Corruption rates in parts per million */
+  uint32_t resyncs, r;
+  int found, intactFound, spurious, intact, i;
+  double rate;
+  BOOL success = bTRUE;
+
+  srand(1);
+  Packet_Init(115200, 50000000);
+  Packet_SetTimeout(0); // Time stamps are byte counts here
+
+  for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+  {
+    MakeStream(rates[r]);
+    for (i = 0, intact = 0; i < NB_PACKETS; i++)
+      intact += Sent[i].Intact;
+
+    resyncs = Packet_ResyncCount();
+    rate = Run(NB_PACKETS, &found, &intactFound, &spurious);
+    resyncs = Packet_ResyncCount() - resyncs;
+
+    printf("%6.3f%% corrupt: %5.1f%% of intact packets found, %d spurious, %u resyncs, %6.1f MB/s\n",
+           rates[r] / 10000.0, 100.0 * intactFound / intact, spurious, resyncs, rate / 1e6);
+
+    if ((rates[r] == 0) && ((found != NB_PACKETS) || spurious || resyncs))
+    {
+      printf("clean stream not received as sent\n");
+      success = bFALSE;
+    }
+    else if ((rates[r] <= 1000) && (intactFound < intact * 99 / 100)) // Alignment is recovered within a packet or two
+    {
+      printf("too many intact packets lost\n");
+      success = bFALSE;
+    }
+    else if ((rates[r] <= 10000) && (intactFound < intact * 95 / 100))
+    {
+      printf("too many intact packets lost\n");
+      success = bFALSE;
+    }
+  }
+
+  for (StreamLength = 0; StreamLength < STREAM_SIZE; StreamLength++) // Nothing but noise, the worst case
+    Stream[StreamLength] = (uint8_t)rand();
+  StreamIndex = 0;
+  resyncs = Packet_ResyncCount();
+  rate = Run(0, &found, &intactFound, &spurious);
+  printf("noise: %u spurious packets, %u resyncs in %u bytes, %6.1f MB/s\n",
+         spurious, Packet_ResyncCount() - resyncs, StreamLength, rate / 1e6);
+
+  printf("packet %s\n", success ? "ok" : "FAILED");
+  return success ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+/*! @file
+ *
+ *  @brief Routines for the hardware CRC module on the TWR-K70F120M.
+ *
+ *  This contains the functions for calculating CRC-16/CCITT checksums with the CRC module.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-02
+ */
+
+/*!
+ *  @addtogroup crc_module CRC module documentation
+ *  @{
+ */
+
+// Included header files
+#include "Cpu.h"
+#include "PE_Types.h"
+#include "types.h"
+#include "MK70F12.h"
+#include "CRC.h"
+
+// CRC-16/CCITT generator polynomial
+#define CRC_POLYNOMIAL 0x1021
+
+
+BOOL CRC_Init(void)
+{
+  SIM_SCGC6 |= SIM_SCGC6_CRC_MASK; // Enable clock gate for CRC module
+
+  CRC_CTRL = 0; // 16-bit CRC, no transposition, no final XOR
+  CRC_GPOLYL = CRC_POLYNOMIAL;
+
+  return bTRUE;
+}
+
+
+uint16_t CRC_Calculate(const uint16_t seed, const uint8_t* const data, const uint16_t length)
+{
+  uint16_t crc; /*!< The result */
+  uint16_t i;
+
+  EnterCritical(); // The module is shared by all threads
+
+  CRC_CTRL |= CRC_CTRL_WAS_MASK; // Next write is the seed
+  CRC_CRCL = seed;
+  CRC_CTRL &= ~CRC_CTRL_WAS_MASK; // Following writes are data
+
+  for (i = 0; i < length; i++)
+    CRC_CRCLL = data[i]; // One byte per write, shifted into the CRC
+
+  crc = CRC_CRCL;
+
+  ExitCritical();
+
+  return crc;
+}
+
+/*!
+ ** @}
+ */
@@ -0,0 +1,38 @@
+/*! @file
+ *
+ *  @brief Routines for the hardware CRC module on the TWR-K70F120M.
+ *
+ *  This contains the functions for calculating CRC-16/CCITT checksums with the CRC module.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-02
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+// new types
+#include "types.h"
+
+// Initial value of a CRC-16/CCITT calculation
+#define CRC_SEED 0xFFFF
+
+/*! @brief Sets up the CRC module before first use.
+ *
+ *  Selects a 16-bit CRC with the CCITT polynomial 0x1021 and no transposition.
+ *  @return BOOL - TRUE if the CRC module was successfully initialized.
+ */
+BOOL CRC_Init(void);
+
+/*! @brief Calculates the CRC of a block of data.
+ *
+ *  A CRC over several blocks is obtained by passing the result for one block as the seed for the next.
+ *  @param seed CRC_SEED for the first block, otherwise the result of the previous block.
+ *  @param data A pointer to the data.
+ *  @param length The number of bytes of data.
+ *  @return uint16_t - The CRC.
+ *  @note Assumes that CRC_Init has been called. Interrupts are disabled while the module is in use.
+ */
+uint16_t CRC_Calculate(const uint16_t seed, const uint8_t* const data, const uint16_t length);
+
+#endif
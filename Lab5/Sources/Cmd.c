@@ -0,0 +1,287 @@
+/*! @file
+ *
+ *  @brief Command dispatch for packets received from the PC.
+ *
+ *  This contains the functions for registering a handler for each command byte, dispatching received packets
+ *  to them and keeping execution statistics for each command.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-04
+ */
+
+/*!
+ *  @addtogroup cmd_module Command module documentation
+ *  @{
+ */
+
+// Included header files
+#include "Cpu.h"
+#include "PE_Types.h"
+#include "types.h"
+#include "MK70F12.h"
+#include "packet.h"
+#include "Cmd.h"
+
+// Number of commands, one per value of the command byte without the acknowledgement bit
+#define CMD_NB_COMMANDS 0x80
+
+// Trace enable in the debug exception and monitor control register, needed by the DWT
+#define CMD_DEMCR_TRCENA_MASK 0x01000000u
+
+// Cycle counter enable in the DWT control register
+#define CMD_DWT_CTRL_CYCCNTENA_MASK 0x00000001u
+
+// Payload of a sequenced request: sequence number, command, parameter 1, 2 and 3
+#define CMD_SEQ_REQUEST_LENGTH 5
+
+static TCmdHandler Handlers[CMD_NB_COMMANDS]; /*!< Handler for each command, NULL if none */
+static TCmdStats Stats[CMD_NB_COMMANDS];      /*!< Execution statistics for each command */
+
+static uint8_t NextSequence;                  /*!< Sequence number of the next request to execute */
+static uint8_t PendingAcks;                   /*!< Requests executed successfully but not yet acknowledged */
+static BOOL Resending;                        /*!< TRUE once the PC has been asked to resend, until the expected request arrives */
+static TCmdCommit Commit;                     /*!< Called before requests are acknowledged, NULL if none */
+
+// Prototypes
+static BOOL CmdStatsHandler(void);
+static void NakPending(void);
+
+
+BOOL Cmd_Init(void)
+{
+  uint8_t command;
+
+  for (command = 0; command < CMD_NB_COMMANDS; command++)
+  {
+    Handlers[command] = NULL;
+    Stats[command] = (TCmdStats){0};
+  }
+  Commit = NULL;
+
+  DEMCR |= CMD_DEMCR_TRCENA_MASK; // Power up the DWT
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= CMD_DWT_CTRL_CYCCNTENA_MASK; // Start the free-running core cycle counter
+
+  return Cmd_Register(CMD_CMDSTATS, CmdStatsHandler);
+}
+
+
+BOOL Cmd_Register(const uint8_t command, const TCmdHandler handler)
+{
+  if (command >= CMD_NB_COMMANDS)
+    return bFALSE;
+
+  EnterCritical(); // Handler and statistics change together
+  Handlers[command] = handler;
+  Stats[command] = (TCmdStats){0};
+  ExitCritical();
+
+  return bTRUE;
+}
+
+
+/*! @brief Calls the handler for Packet_Command and updates its statistics.
+ *
+ *  @return BOOL - TRUE if the command was carried out.
+ */
+static BOOL Execute(void)
+{
+  uint8_t command = Packet_Command & ~CMD_ACK_REQUEST_MASK; /*!< Command excluding the ACK bit */
+  TCmdHandler handler = Handlers[command];                  /*!< Handler registered for the command */
+  BOOL success = bFALSE;                                    /*!< Initially success flag set to false */
+  uint32_t start, cycles;
+
+  start = DWT_CYCCNT;
+  if (handler)
+    success = handler();
+  cycles = DWT_CYCCNT - start; // Unsigned difference is correct across a counter wrap
+
+  EnterCritical(); // CmdStatsHandler may run from another thread
+  Stats[command].calls++;
+  if (!success)
+    Stats[command].failures++;
+  Stats[command].totalCycles += cycles;
+  if (cycles > Stats[command].maxCycles)
+    Stats[command].maxCycles = cycles;
+  ExitCritical();
+
+  return success;
+}
+
+
+/*! @brief Handles a sequencing packet, either a window reset or a sequenced request.
+ *
+ *  Requests are executed strictly in sequence order. A request that fails is NAKed at once, after the ACKs before it;
+ *  requests that succeed are acknowledged together by one "ACK up to" packet, once the commit function has succeeded,
+ *  and are NAKed if it fails. A request beyond the expected one means
+ *  that a request was lost, so the PC is asked once to resend from the expected one and later requests are discarded
+ *  until it arrives. A request before the expected one is a retransmission, it is not executed again.
+ *  @return BOOL - TRUE if the request was carried out.
+ */
+static BOOL Sequenced(void)
+{
+  uint8_t sequence; /*!< Sequence number of the request */
+  uint8_t offset;   /*!< Distance of the request from the expected one, modulo 256 */
+  BOOL success;
+
+  if (Packet_Length == 0) // Plain packet, window control
+  {
+    if (Packet_Parameter1 != CMD_SEQ_RESET)
+      return bFALSE;
+
+    NextSequence = Packet_Parameter2; // First sequence number the PC will use
+    PendingAcks = 0;
+    Resending = bFALSE;
+    return Packet_Put(CMD_SEQUENCED, CMD_SEQ_ACK, (uint8_t)(NextSequence - 1), CMD_SEQ_WINDOW); // Nothing acknowledged yet, advertise the window
+  }
+
+  if (Packet_Length != CMD_SEQ_REQUEST_LENGTH)
+    return bFALSE;
+
+  sequence = Packet_Payload[0];
+  offset = sequence - NextSequence;
+
+  if (offset >= 0x80) // Already executed, the PC missed the acknowledgement or the request was NAKed by a failed commit
+  {
+    if (Commit && !Commit()) // Its effect is still waiting to be made permanent, try again
+    {
+      NakPending();
+      return Packet_Put(CMD_SEQUENCED, CMD_SEQ_NAK, sequence, CMD_SEQ_WINDOW);
+    }
+    PendingAcks = 0;
+    return Packet_Put(CMD_SEQUENCED, CMD_SEQ_ACK, (uint8_t)(NextSequence - 1), CMD_SEQ_WINDOW);
+  }
+
+  if (offset) // A request was lost, ask once for everything from the expected one
+  {
+    if (Resending)
+      return bFALSE;
+
+    Cmd_Flush();
+    Resending = bTRUE;
+    return Packet_Put(CMD_SEQUENCED, CMD_SEQ_RESEND, NextSequence, CMD_SEQ_WINDOW);
+  }
+
+  Resending = bFALSE;
+  NextSequence++;
+
+  Packet_Command = Packet_Payload[1] & ~CMD_ACK_REQUEST_MASK; // Present the request as a plain packet, the sequence replaces the ACK bit
+  Packet_Parameter1 = Packet_Payload[2];
+  Packet_Parameter2 = Packet_Payload[3];
+  Packet_Parameter3 = Packet_Payload[4];
+  Packet_Length = 0;
+
+  success = Execute();
+
+  if (!success)
+  {
+    Cmd_Flush(); // Keep the replies in sequence order
+    Packet_Put(CMD_SEQUENCED, CMD_SEQ_NAK, sequence, CMD_SEQ_WINDOW);
+    return bFALSE;
+  }
+
+  if (++PendingAcks >= CMD_SEQ_WINDOW / 2) // Acknowledge early enough for the PC to keep the window full
+    Cmd_Flush();
+  return bTRUE;
+}
+
+
+BOOL Cmd_Dispatch(void)
+{
+  BOOL success; /*!< TRUE if the command was carried out */
+
+  if ((Packet_Command & ~CMD_ACK_REQUEST_MASK) == CMD_SEQUENCED)
+    return Sequenced();
+
+  success = Execute();
+
+  if (Packet_Command & CMD_ACK_REQUEST_MASK) // Check for ACK request, a handler may have sent the ACK itself and cleared it
+  {
+    if (!success)
+      Packet_Command &= ~CMD_ACK_REQUEST_MASK; // Clear ACK flag if packet handling was unsuccessful
+
+    Packet_Put(Packet_Command,Packet_Parameter1,Packet_Parameter2,Packet_Parameter3); // Send packet
+  }
+
+  return success;
+}
+
+
+void Cmd_SetCommit(const TCmdCommit commit)
+{
+  Commit = commit;
+}
+
+
+/*! @brief NAKs each request executed but not yet acknowledged, in sequence order.
+ *
+ */
+static void NakPending(void)
+{
+  uint8_t sequence; /*!< Sequence number of a request not yet acknowledged */
+
+  for (sequence = NextSequence - PendingAcks; sequence != NextSequence; sequence++)
+    Packet_Put(CMD_SEQUENCED, CMD_SEQ_NAK, sequence, CMD_SEQ_WINDOW);
+  PendingAcks = 0;
+}
+
+
+void Cmd_Flush(void)
+{
+  if (!PendingAcks)
+    return;
+
+  if (Commit && !Commit()) // The requests ran but did not all take effect, the PC must not drop them
+    NakPending();
+  else
+  {
+    PendingAcks = 0;
+    Packet_Put(CMD_SEQUENCED, CMD_SEQ_ACK, (uint8_t)(NextSequence - 1), CMD_SEQ_WINDOW); // ACK up to the last request executed
+  }
+}
+
+
+BOOL Cmd_GetStats(const uint8_t command, TCmdStats* const stats)
+{
+  if (command >= CMD_NB_COMMANDS)
+    return bFALSE;
+
+  EnterCritical();
+  *stats = Stats[command];
+  ExitCritical();
+
+  return bTRUE;
+}
+
+
+/*! @brief Command 0x11 : get the statistics of the command in parameter 1.
+ *
+ *  Replies with an extended packet holding the calls, failures, the lower 32 bits of the total cycles, the maximum cycles
+ *  and the upper 32 bits of the total cycles, each least significant byte first.
+ *  @return BOOL - TRUE if the statistics were sent.
+ */
+static BOOL CmdStatsHandler(void)
+{
+  TCmdStats stats;     /*!< Snapshot of the selected command */
+  uint32_t counter[5]; /*!< The counters in reply order */
+  uint8_t payload[20]; /*!< The counters, least significant byte first */
+  uint8_t i;
+
+  if (!Cmd_GetStats(Packet_Parameter1, &stats))
+    return bFALSE;
+
+  counter[0] = stats.calls;
+  counter[1] = stats.failures;
+  counter[2] = (uint32_t)stats.totalCycles;
+  counter[3] = stats.maxCycles;
+  counter[4] = (uint32_t)(stats.totalCycles >> 32); // Last, so a reader of the first four counters still works
+
+  for (i = 0; i < sizeof(payload); i++)
+    payload[i] = (uint8_t)(counter[i / 4] >> (8 * (i % 4)));
+
+  return Packet_PutExtended(CMD_CMDSTATS, payload, sizeof(payload));
+}
+
+/*!
+ ** @}
+ */
@@ -0,0 +1,106 @@
+/*! @file
+ *
+ *  @brief Command dispatch for packets received from the PC.
+ *
+ *  This contains the functions for registering a handler for each command byte, dispatching received packets
+ *  to them and keeping execution statistics for each command.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-04
+ */
+
+#ifndef CMD_H
+#define CMD_H
+
+// new types
+#include "types.h"
+
+// Bit of the command byte that requests an acknowledgement
+#define CMD_ACK_REQUEST_MASK 0x80
+
+// Command to query the execution statistics of a command
+#define CMD_CMDSTATS 0x11
+
+// Sequenced requests, so that the PC can have several requests in flight:
+// the PC sends an extended packet with this command and payload sequence number, command, parameter 1, 2 and 3.
+// The tower replies with plain packets of this command, parameter 1 the kind, parameter 2 a sequence number
+// and parameter 3 the window, the number of requests the PC may have unacknowledged.
+#define CMD_SEQUENCED 0x12
+#define CMD_SEQ_WINDOW 8
+
+// Kinds of sequencing packet in parameter 1
+#define CMD_SEQ_RESET 0  /*!< PC to tower: start a new window, parameter 2 the first sequence number */
+#define CMD_SEQ_ACK 1    /*!< Every request up to and including the sequence number succeeded, except those NAKed */
+#define CMD_SEQ_NAK 2    /*!< The request with the sequence number was executed but failed */
+#define CMD_SEQ_RESEND 3 /*!< Requests from the sequence number on were not executed and must be resent */
+
+/*! @brief Handles the packet in Packet_Command and its parameters.
+ *
+ *  @return BOOL - TRUE if the command was carried out, and is acknowledged if an acknowledgement was requested.
+ */
+typedef BOOL (*TCmdHandler)(void);
+
+/*! @brief Makes the effects of the requests executed so far permanent, such as programming changed non-volatile variables.
+ *
+ *  @return BOOL - TRUE if everything was made permanent.
+ */
+typedef BOOL (*TCmdCommit)(void);
+
+/*!
+ * @struct TCmdStats
+ */
+typedef struct
+{
+  uint32_t calls;       /*!< Number of times the handler was called */
+  uint32_t failures;    /*!< Number of times the handler returned FALSE */
+  uint64_t totalCycles; /*!< Sum of the execution times in core clock cycles, 32 bits would wrap after 35 s at 120 MHz */
+  uint32_t maxCycles;   /*!< Longest execution time in core clock cycles */
+} TCmdStats;
+
+/*! @brief Sets up the dispatch table and the cycle counter, and registers CMD_CMDSTATS.
+ *
+ *  @return BOOL - TRUE if the dispatcher was successfully initialized.
+ */
+BOOL Cmd_Init(void);
+
+/*! @brief Registers the handler for a command.
+ *
+ *  @param command The command byte, without the acknowledgement bit.
+ *  @param handler The function to call when the command is received, NULL to ignore the command.
+ *  @return BOOL - TRUE if the command is in range.
+ *  @note Assumes that Cmd_Init has been called. Registering again replaces the handler and clears its statistics.
+ */
+BOOL Cmd_Register(const uint8_t command, const TCmdHandler handler);
+
+/*! @brief Calls the handler for the packet last received by Packet_Get and sends the acknowledgement.
+ *
+ *  Packets without a registered handler are counted as failures of that command.
+ *  Sequenced requests are acknowledged by sequence number instead, see CMD_SEQUENCED.
+ *  @return BOOL - TRUE if the command was carried out.
+ *  @note Assumes that Cmd_Init has been called and that Packet_Get has returned TRUE.
+ */
+BOOL Cmd_Dispatch(void);
+
+/*! @brief Sets the function called before sequenced requests are acknowledged.
+ *
+ *  @param commit The function, NULL if requests take effect as they are executed.
+ *  @note Assumes that Cmd_Init has been called.
+ */
+void Cmd_SetCommit(const TCmdCommit commit);
+
+/*! @brief Sends the acknowledgement of the sequenced requests executed since the last one.
+ *
+ *  The commit function is called first. If it fails, each of those requests is NAKed instead, so the PC sends them again.
+ *  @note Call once no more packets are waiting, so that the PC is not left waiting for a coalesced acknowledgement.
+ */
+void Cmd_Flush(void);
+
+/*! @brief Gets the execution statistics of a command.
+ *
+ *  @param command The command byte, without the acknowledgement bit.
+ *  @param stats A pointer to a structure that receives a snapshot of the statistics.
+ *  @return BOOL - TRUE if the command is in range.
+ */
+BOOL Cmd_GetStats(const uint8_t command, TCmdStats* const stats);
+
+#endif
@@ -0,0 +1,161 @@
+/*! @file
+ *
+ *  @brief Delta and run-length compression of telemetry samples.
+ *
+ *  This contains the functions for encoding XYZ samples as nibble-packed differences from the previous sample,
+ *  with runs of unchanged samples collapsed and periodic keyframes that let a decoder recover after a loss.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-05
+ */
+
+/*!
+ *  @addtogroup delta_module Delta module documentation
+ *  @{
+ */
+
+// Included header files
+#include "types.h"
+#include "Delta.h"
+
+// Escape nibble, the X difference -8 which delta samples never use
+#define DELTA_ESCAPE 0x8
+
+// Nibbles after the escape
+#define DELTA_LONG_RUN 0xE
+#define DELTA_KEYFRAME 0xF
+
+// Longest run of each form
+#define DELTA_SHORT_RUN_MAX 15
+#define DELTA_LONG_RUN_MAX 256
+
+// Prototypes
+static void PutNibble(TDeltaCodec* const codec, const uint8_t nibble);
+static void PutRun(TDeltaCodec* const codec);
+
+
+void Delta_Init(TDeltaCodec* const codec, uint8_t* const buffer, const uint16_t size, const uint16_t keyInterval)
+{
+  codec->Buffer = buffer;
+  codec->Size = size;
+  codec->NbNibbles = 0;
+  codec->Overflow = bFALSE;
+  codec->Run = 0;
+  codec->KeyInterval = keyInterval;
+  codec->SinceKey = 0;
+  codec->KeyNeeded = bTRUE;
+}
+
+
+/*! @brief Appends a nibble to the buffer.
+ *
+ *  @param codec The encoder state.
+ *  @param nibble The value, only the low 4 bits are used.
+ */
+static void PutNibble(TDeltaCodec* const codec, const uint8_t nibble)
+{
+  uint16_t index = codec->NbNibbles / 2; /*!< Byte the nibble goes in */
+
+  if (index >= codec->Size)
+  {
+    codec->Overflow = bTRUE;
+    return;
+  }
+
+  if (codec->NbNibbles & 1)
+    codec->Buffer[index] |= nibble & 0x0F;
+  else
+    codec->Buffer[index] = nibble << 4; // High nibble first
+
+  codec->NbNibbles++;
+}
+
+
+/*! @brief Writes the pending run of unchanged samples.
+ *
+ *  @param codec The encoder state.
+ */
+static void PutRun(TDeltaCodec* const codec)
+{
+  if (codec->Run == 1) // A zero delta sample is shorter than a run
+  {
+    PutNibble(codec, 0);
+    PutNibble(codec, 0);
+    PutNibble(codec, 0);
+  }
+  else if (codec->Run && (codec->Run <= DELTA_SHORT_RUN_MAX))
+  {
+    PutNibble(codec, DELTA_ESCAPE);
+    PutNibble(codec, codec->Run - 2);
+  }
+  else if (codec->Run)
+  {
+    PutNibble(codec, DELTA_ESCAPE);
+    PutNibble(codec, DELTA_LONG_RUN);
+    PutNibble(codec, (codec->Run - 1) >> 4);
+    PutNibble(codec, codec->Run - 1);
+  }
+
+  codec->Run = 0;
+}
+
+
+BOOL Delta_Encode(TDeltaCodec* const codec, const uint8_t sample[3])
+{
+  int8_t dx = (int8_t)(sample[0] - codec->Last[0]); /*!< Differences from the previous sample */
+  int8_t dy = (int8_t)(sample[1] - codec->Last[1]);
+  int8_t dz = (int8_t)(sample[2] - codec->Last[2]);
+  uint8_t axis;
+
+  if (codec->KeyInterval && (codec->SinceKey >= codec->KeyInterval))
+    codec->KeyNeeded = bTRUE;
+  codec->SinceKey++;
+
+  if (!codec->KeyNeeded && !dx && !dy && !dz) // Unchanged, extend the run
+  {
+    if (++codec->Run == DELTA_LONG_RUN_MAX)
+      PutRun(codec);
+    return !codec->Overflow;
+  }
+
+  PutRun(codec);
+
+  if (codec->KeyNeeded || (dx < -7) || (dx > 7) || (dy < -8) || (dy > 7) || (dz < -8) || (dz > 7))
+  {
+    PutNibble(codec, DELTA_ESCAPE); // Absolute values, also for differences too large for a nibble
+    PutNibble(codec, DELTA_KEYFRAME);
+    for (axis = 0; axis < 3; axis++)
+    {
+      PutNibble(codec, sample[axis] >> 4);
+      PutNibble(codec, sample[axis]);
+    }
+    codec->KeyNeeded = bFALSE;
+    codec->SinceKey = 1;
+  }
+  else
+  {
+    PutNibble(codec, dx);
+    PutNibble(codec, dy);
+    PutNibble(codec, dz);
+  }
+
+  for (axis = 0; axis < 3; axis++)
+    codec->Last[axis] = sample[axis];
+
+  return !codec->Overflow;
+}
+
+
+uint16_t Delta_Finish(TDeltaCodec* const codec)
+{
+  PutRun(codec);
+
+  if (codec->Overflow)
+    return 0;
+
+  return (codec->NbNibbles + 1) / 2; // A trailing half byte is already zero padded
+}
+
+/*!
+ ** @}
+ */
@@ -0,0 +1,66 @@
+/*! @file
+ *
+ *  @brief Delta and run-length compression of telemetry samples.
+ *
+ *  This contains the functions for encoding XYZ samples as nibble-packed differences from the previous sample,
+ *  with runs of unchanged samples collapsed and periodic keyframes that let a decoder recover after a loss.
+ *
+ *  Encoded samples are a stream of 4-bit nibbles, most significant nibble of each byte first:
+ *  - a delta sample is three nibbles, the X, Y and Z differences as two's complement, X from -7 to 7, Y and Z from -8 to 7;
+ *  - a nibble of 0x8 (X difference -8) is an escape, followed by one of
+ *    - 0x0 to 0xD, a run of 2 to 15 samples equal to the previous one,
+ *    - 0xE and two nibbles n, a run of n + 1 samples equal to the previous one,
+ *    - 0xF and six nibbles, a keyframe holding the absolute X, Y and Z values.
+ *  The last byte is padded with a zero nibble if needed; the decoder stops after the known number of samples.
+ *
+ *  @author Manujaya Kankanige & Smit Patel
+ *  @date 2016-06-05
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+// new types
+#include "types.h"
+
+/*!
+ * @struct TDeltaCodec
+ */
+typedef struct
+{
+  uint8_t *Buffer;        /*!< Where the encoded nibbles go */
+  uint16_t Size;          /*!< Size of the buffer in bytes */
+  uint16_t NbNibbles;     /*!< Number of nibbles written */
+  BOOL Overflow;          /*!< TRUE once a nibble did not fit */
+  uint8_t Last[3];        /*!< The previous sample */
+  uint16_t Run;           /*!< Number of samples equal to the previous one not yet written */
+  uint16_t KeyInterval;   /*!< Number of samples between keyframes, 0 for a keyframe at the start only */
+  uint16_t SinceKey;      /*!< Number of samples since the last keyframe */
+  BOOL KeyNeeded;         /*!< TRUE if the next sample must be a keyframe */
+} TDeltaCodec;
+
+/*! @brief Starts encoding into a buffer. The first sample is always a keyframe.
+ *
+ *  @param codec The encoder state.
+ *  @param buffer Where the encoded samples go.
+ *  @param size The size of the buffer in bytes.
+ *  @param keyInterval The number of samples between keyframes, 0 for a keyframe at the start only.
+ */
+void Delta_Init(TDeltaCodec* const codec, uint8_t* const buffer, const uint16_t size, const uint16_t keyInterval);
+
+/*! @brief Encodes one sample.
+ *
+ *  @param codec The encoder state.
+ *  @param sample The X, Y and Z values, two's complement.
+ *  @return BOOL - TRUE if the sample fitted in the buffer. Once FALSE, the buffer contents are not usable.
+ */
+BOOL Delta_Encode(TDeltaCodec* const codec, const uint8_t sample[3]);
+
+/*! @brief Writes any pending run and pads the last byte.
+ *
+ *  @param codec The encoder state.
+ *  @return uint16_t - The number of bytes in the buffer, 0 if the samples did not fit.
+ */
+uint16_t Delta_Finish(TDeltaCodec* const codec);
+
+#endif
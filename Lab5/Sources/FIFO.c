@@ -19,55 +19,172 @@
 
 void FIFO_Init(TFIFO * const FIFO)
 {
-  FIFO->NbBytes = 0; // Initialize The number of bytes stored in the FIFO to 0
-  FIFO->Start = 0; // Initialize the head pointer to position 0
-  FIFO->End = 0; // Initialize the tail pointer to position 0
+  FIFO->Start = 0; // Initialize the head index to position 0
+  FIFO->End = 0; // Initialize the tail index to position 0
+  FIFO->GetWaiting = 0; // Nobody is waiting yet
+  FIFO->PutWaiting = 0;
+  FIFO->WakeLevel = 1; // Wake the consumer for every byte
   FIFO->NotFullSemaphore = OS_SemaphoreCreate(0); // FIFO not full semaphore initialized to 0
   FIFO->NotEmptySemaphore = OS_SemaphoreCreate(0); // FIFO not empty semaphore initialized to 0
 }
 
 
-BOOL FIFO_Put(TFIFO * const FIFO, const uint8_t data)
+void FIFO_SetWakeLevel(TFIFO * const FIFO, const uint16_t wakeLevel)
 {
-  if (FIFO->NbBytes == FIFO_SIZE) // Check if FIFO buffer is full
-    OS_SemaphoreWait(FIFO->NotFullSemaphore,0); // Wait for signal saying FIFO is not full
+  if (wakeLevel == 0)
+    FIFO->WakeLevel = 1;
+  else if (wakeLevel > FIFO_SIZE) // A full FIFO must always wake the consumer
+    FIFO->WakeLevel = FIFO_SIZE;
   else
+    FIFO->WakeLevel = wakeLevel;
+}
+
+
+void FIFO_Wake(TFIFO * const FIFO)
+{
+  if (FIFO->GetWaiting && FIFO_Count(FIFO)) // Trailing data below the wake level
+    OS_SemaphoreSignal(FIFO->NotEmptySemaphore);
+}
+
+
+uint16_t FIFO_Count(const TFIFO * const FIFO)
+{
+  return (uint16_t)(FIFO->End - FIFO->Start); // Free-running indices, so the difference is correct across wrap around
+}
+
+
+BOOL FIFO_Put(TFIFO * const FIFO, const uint8_t data)
+{
+  while (FIFO_Count(FIFO) == FIFO_SIZE) // Check if FIFO buffer is full
   {
-    FIFO->Buffer[FIFO->End] = data; // Put data into FIFO buffer
+    FIFO->PutWaiting = 1; // Ask the consumer for a signal
+    if (FIFO_Count(FIFO) == FIFO_SIZE) // Re-check in case the consumer made space before it saw the flag
+      OS_SemaphoreWait(FIFO->NotFullSemaphore,0); // Wait for signal saying FIFO is not full
+    FIFO->PutWaiting = 0;
+  }
 
-    if (FIFO->End == FIFO_SIZE-1) // Reset the tail pointer position to 0 if it reaches the end of the buffer
-      FIFO->End = 0;
-    else
-      FIFO->End++; // Move tail pointer to next position
+  FIFO->Buffer[FIFO->End & FIFO_MASK] = data; // Put data into FIFO buffer
+  FIFO->End++; // Publish the byte to the consumer
 
-    FIFO->NbBytes++; // Increment value of number of bytes in FIFO
+  if (FIFO->GetWaiting && (FIFO_Count(FIFO) >= FIFO->WakeLevel)) // Only signal if the consumer is blocked and enough data has arrived
     OS_SemaphoreSignal(FIFO->NotEmptySemaphore); // Signal saying FIFO is not empty
+
+  return bTRUE;
+}
+
+
+void FIFO_Wait(TFIFO * const FIFO)
+{
+  while (FIFO_Count(FIFO) == 0) // Checking if FIFO buffer is empty
+  {
+    FIFO->GetWaiting = 1; // Ask the producer for a signal
+    if (FIFO_Count(FIFO) == 0) // Re-check in case the producer added data before it saw the flag
+      OS_SemaphoreWait(FIFO->NotEmptySemaphore,0); // Wait for signal that FIFO is not empty
+    FIFO->GetWaiting = 0;
   }
 }
 
 
 BOOL FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr)
 {
-  if (FIFO->NbBytes == 0) // Checking if FIFO buffer is empty
-    OS_SemaphoreWait(FIFO->NotEmptySemaphore,0); // Wait for signal that FIFO is not empty
-  else
-  {
-    *dataPtr = FIFO->Buffer[FIFO->Start]; // Get oldest data in FIFO and place it in dataPtr
+  FIFO_Wait(FIFO); // Block until there is data
 
-    if (FIFO->Start == FIFO_SIZE-1) // Reset the head pointer position to 0 if it reaches the end of the buffer
-      FIFO->Start = 0;
-    else
-      FIFO->Start++; // Move head pointer to next position
+  *dataPtr = FIFO->Buffer[FIFO->Start & FIFO_MASK]; // Get oldest data in FIFO and place it in dataPtr
+  FIFO->Start++; // Release the position to the producer
 
-    FIFO->NbBytes--; // Decrement value of number of bytes in FIFO
+  if (FIFO->PutWaiting) // Only signal if the producer is blocked
     OS_SemaphoreSignal(FIFO->NotFullSemaphore); // Signal saying FIFO is not full
 
-    return bTRUE; // Byte extracted from FIFO successfully
-  }
+  return bTRUE; // Byte extracted from FIFO successfully
+}
+
+
+uint16_t FIFO_PutN(TFIFO * const FIFO, const uint8_t * const data, const uint16_t nbBytes)
+{
+  uint16_t end = FIFO->End; /*!< Local copy of the tail index */
+  uint16_t count = FIFO_SIZE - FIFO_Count(FIFO); /*!< Number of bytes that fit */
+  uint16_t i;
+
+  if (count > nbBytes)
+    count = nbBytes;
+
+  for (i = 0; i < count; i++)
+    FIFO->Buffer[(end + i) & FIFO_MASK] = data[i]; // Copy into the FIFO buffer
+
+  FIFO->End = end + count; // Publish all the bytes at once
+
+  if (count && FIFO->GetWaiting && (FIFO_Count(FIFO) >= FIFO->WakeLevel)) // Only signal if the consumer is blocked and enough data has arrived
+    OS_SemaphoreSignal(FIFO->NotEmptySemaphore);
+
+  return count;
+}
+
+
+uint16_t FIFO_GetN(TFIFO * const FIFO, uint8_t * const data, const uint16_t nbBytes)
+{
+  uint16_t start = FIFO->Start; /*!< Local copy of the head index */
+  uint16_t count = FIFO_Count(FIFO); /*!< Number of bytes available */
+  uint16_t i;
+
+  if (count > nbBytes)
+    count = nbBytes;
+
+  for (i = 0; i < count; i++)
+    data[i] = FIFO->Buffer[(start + i) & FIFO_MASK]; // Copy out of the FIFO buffer
+
+  FIFO->Start = start + count; // Release all the positions at once
+
+  if (count && FIFO->PutWaiting) // Only signal if the producer is blocked
+    OS_SemaphoreSignal(FIFO->NotFullSemaphore);
+
+  return count;
+}
+
+
+uint16_t FIFO_PeekRead(TFIFO * const FIFO, uint8_t ** const spanPtr)
+{
+  uint16_t offset = FIFO->Start & FIFO_MASK; /*!< Position of the oldest byte in the buffer */
+  uint16_t count = FIFO_Count(FIFO);          /*!< Number of bytes available */
+
+  if (offset + count > FIFO_SIZE) // Stop at the end of the buffer, the wrapped part is the next span
+    count = FIFO_SIZE - offset;
+
+  *spanPtr = &FIFO->Buffer[offset];
+  return count;
+}
+
+
+void FIFO_CommitRead(TFIFO * const FIFO, const uint16_t nbBytes)
+{
+  FIFO->Start += nbBytes; // Release the positions to the producer
+
+  if (nbBytes && FIFO->PutWaiting) // Only signal if the producer is blocked
+    OS_SemaphoreSignal(FIFO->NotFullSemaphore);
+}
+
+
+uint16_t FIFO_PeekWrite(TFIFO * const FIFO, uint8_t ** const spanPtr)
+{
+  uint16_t offset = FIFO->End & FIFO_MASK;           /*!< Position of the next empty byte in the buffer */
+  uint16_t count = FIFO_SIZE - FIFO_Count(FIFO);     /*!< Number of bytes free */
+
+  if (offset + count > FIFO_SIZE) // Stop at the end of the buffer, the wrapped part is the next span
+    count = FIFO_SIZE - offset;
+
+  *spanPtr = &FIFO->Buffer[offset];
+  return count;
+}
+
+
+void FIFO_CommitWrite(TFIFO * const FIFO, const uint16_t nbBytes)
+{
+  FIFO->End += nbBytes; // Publish the bytes to the consumer
+
+  if (nbBytes && FIFO->GetWaiting && (FIFO_Count(FIFO) >= FIFO->WakeLevel)) // Only signal if the consumer is blocked and enough data has arrived
+    OS_SemaphoreSignal(FIFO->NotEmptySemaphore);
 }
 
 
 /*!
  * @}
 */
-
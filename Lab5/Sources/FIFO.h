@@ -3,6 +3,9 @@
  *  @brief Routines to implement a FIFO buffer.
  *
  *  This contains the structure and "methods" for accessing a byte-wide FIFO.
+ *  The FIFO is a single-producer/single-consumer ring: only the producer writes End
+ *  and only the consumer writes Start, so an ISR and a thread can share a FIFO
+ *  without a critical section.
  *
  *  @author PMcL
  *  @date 2015-07-23
@@ -15,20 +18,25 @@
 #include "OS.h"
 #include "types.h"
 
-// Number of bytes in a FIFO
+// Number of bytes in a FIFO - must be a power of 2
 #define FIFO_SIZE 256
 
+// Mask to wrap a free-running index onto the buffer
+#define FIFO_MASK (FIFO_SIZE - 1)
+
 /*!
  * @struct TFIFO
  */
 typedef struct
 {
-  uint16_t Start;		/*!< The index of the position of the oldest data in the FIFO */
-  uint16_t End; 		/*!< The index of the next available empty position in the FIFO */
-  uint16_t volatile NbBytes;	/*!< The number of bytes currently stored in the FIFO */
-  uint8_t Buffer[FIFO_SIZE];	/*!< The actual array of bytes to store the data */
-  OS_ECB *NotEmptySemaphore;
-  OS_ECB *NotFullSemaphore;
+  uint16_t volatile Start;		/*!< Free-running index of the oldest data in the FIFO, only written by the consumer */
+  uint16_t volatile End; 		/*!< Free-running index of the next available empty position in the FIFO, only written by the producer */
+  uint8_t Buffer[FIFO_SIZE];		/*!< The actual array of bytes to store the data */
+  uint8_t volatile GetWaiting;		/*!< Set while the consumer is blocked on NotEmptySemaphore */
+  uint8_t volatile PutWaiting;		/*!< Set while the producer is blocked on NotFullSemaphore */
+  uint16_t WakeLevel;			/*!< Number of stored bytes needed before a waiting consumer is signaled */
+  OS_ECB *NotEmptySemaphore;		/*!< Signaled when data is put into the FIFO and the consumer is waiting */
+  OS_ECB *NotFullSemaphore;		/*!< Signaled when data is removed from the FIFO and the producer is waiting */
 } TFIFO;
 
 /*! @brief Initialize the FIFO before first use.
@@ -40,20 +48,110 @@ void FIFO_Init(TFIFO* const FIFO);
 
 /*! @brief Put one character into the FIFO.
  *
+ *  Waits for space if the FIFO is full.
  *  @param FIFO A pointer to a FIFO struct where data is to be stored.
  *  @param data A byte of data to store in the FIFO buffer.
  *  @return BOOL - TRUE if data is successfully stored in the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Assumes that FIFO_Init has been called. Must not be called from an ISR.
  */
 BOOL FIFO_Put(TFIFO* const FIFO, const uint8_t data);
 
 /*! @brief Get one character from the FIFO.
  *
+ *  Waits for data if the FIFO is empty.
  *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
  *  @param dataPtr A pointer to a memory location to place the retrieved byte.
  *  @return BOOL - TRUE if data is successfully retrieved from the FIFO.
- *  @note Assumes that FIFO_Init has been called.
+ *  @note Assumes that FIFO_Init has been called. Must not be called from an ISR.
  */
 BOOL FIFO_Get(TFIFO* const FIFO, uint8_t* const dataPtr);
 
+/*! @brief Waits until the FIFO holds data, without removing any.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @note Assumes that FIFO_Init has been called. Must not be called from an ISR.
+ */
+void FIFO_Wait(TFIFO* const FIFO);
+
+/*! @brief Put as many bytes as will fit into the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A pointer to the bytes to store in the FIFO buffer.
+ *  @param nbBytes The number of bytes to store.
+ *  @return uint16_t - The number of bytes actually stored, which is less than nbBytes if the FIFO filled up.
+ *  @note Assumes that FIFO_Init has been called. Never waits, so may be called from an ISR.
+ */
+uint16_t FIFO_PutN(TFIFO* const FIFO, const uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Get as many bytes as are available from the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to memory to place the retrieved bytes.
+ *  @param nbBytes The maximum number of bytes to retrieve.
+ *  @return uint16_t - The number of bytes actually retrieved, which is less than nbBytes if the FIFO emptied.
+ *  @note Assumes that FIFO_Init has been called. Never waits, so may be called from an ISR.
+ */
+uint16_t FIFO_GetN(TFIFO* const FIFO, uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Gets the largest contiguous block of data that can be read in place.
+ *
+ *  The data stays in the FIFO until FIFO_CommitRead is called.
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param spanPtr A pointer to memory to store the address of the oldest byte in the FIFO buffer.
+ *  @return uint16_t - The number of contiguous bytes available at *spanPtr, 0 if the FIFO is empty.
+ *  @note Assumes that FIFO_Init has been called. Only the consumer may call this function.
+ */
+uint16_t FIFO_PeekRead(TFIFO* const FIFO, uint8_t** const spanPtr);
+
+/*! @brief Removes bytes that have been read in place from the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @param nbBytes The number of bytes to remove, no more than the last FIFO_PeekRead returned.
+ *  @note Assumes that FIFO_Init has been called. Only the consumer may call this function.
+ */
+void FIFO_CommitRead(TFIFO* const FIFO, const uint16_t nbBytes);
+
+/*! @brief Gets the largest contiguous block of free space that can be written in place.
+ *
+ *  The data is not visible to the consumer until FIFO_CommitWrite is called.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param spanPtr A pointer to memory to store the address of the next empty position in the FIFO buffer.
+ *  @return uint16_t - The number of contiguous bytes free at *spanPtr, 0 if the FIFO is full.
+ *  @note Assumes that FIFO_Init has been called. Only the producer may call this function.
+ */
+uint16_t FIFO_PeekWrite(TFIFO* const FIFO, uint8_t** const spanPtr);
+
+/*! @brief Adds bytes that have been written in place to the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @param nbBytes The number of bytes to add, no more than the last FIFO_PeekWrite returned.
+ *  @note Assumes that FIFO_Init has been called. Only the producer may call this function.
+ */
+void FIFO_CommitWrite(TFIFO* const FIFO, const uint16_t nbBytes);
+
+/*! @brief Sets how many bytes must be stored before a waiting consumer is woken.
+ *
+ *  A level above 1 lets a producer batch several bytes per wake up. The producer must then call
+ *  FIFO_Wake when no more data is coming soon, e.g. when the line goes idle.
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @param wakeLevel The number of bytes, from 1 to FIFO_SIZE.
+ *  @note Assumes that FIFO_Init has been called. FIFO_Init sets a level of 1.
+ */
+void FIFO_SetWakeLevel(TFIFO* const FIFO, const uint16_t wakeLevel);
+
+/*! @brief Wakes a waiting consumer if there is any data in the FIFO, regardless of the wake level.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @note Assumes that FIFO_Init has been called. Only the producer may call this function.
+ */
+void FIFO_Wake(TFIFO* const FIFO);
+
+/*! @brief Gets the number of bytes currently stored in the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @return uint16_t - The number of bytes in the FIFO.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+uint16_t FIFO_Count(const TFIFO* const FIFO);
+
 #endif
@@ -14,15 +14,69 @@
  */
 
 // Included header files
+#include "Cpu.h"
+#include "PE_Types.h"
 #include "types.h"
 #include "MK70F12.h"
+#include "OS.h"
 #include "packet.h"
+#include "Cmd.h"
 #include "Flash.h"
 
 // Definitions
-#define ACCERR_FPVIOL_ERROR (FTFE_FSTAT && (FTFE_FSTAT_FPVIOL_MASK && FTFE_FSTAT_ACCERR_MASK)) // Bits showing ACCER Error or FPVIOL Error
-#define CHECK_BIT(x,n) ((x >> (n)) & 1) // Macro to compare each bit with LSB
+#define ACCERR_FPVIOL_ERROR (FTFE_FSTAT & (FTFE_FSTAT_FPVIOL_MASK | FTFE_FSTAT_ACCERR_MASK)) // Bits showing ACCER Error or FPVIOL Error
+#define COMMAND_ERROR (FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK | FTFE_FSTAT_MGSTAT0_MASK) // Protection, access or verify error
 
+// Commands waiting for the flash controller, the first one is running
+#define FLASH_QUEUE_SIZE 4
+
+// FTFE command that programs phrases from the section program buffer
+#define FLASH_CMD_PROGRAM_SECTION 0x0B
+
+// FlexRAM, the section program buffer while it is not used for EEPROM
+#define FLEXRAM_START 0x14000000u
+// Bytes programmed by one Program Section command, a quarter of the FlexRAM
+#define SECTION_SIZE 0x1000u
+// Program Section works on pairs of phrases
+#define SECTION_ALIGN 16
+
+// Program flash that bulk programming may use: block 1, where no code runs, without the non-volatile variables
+#define BLOCK1_START 0x00080000u
+#define BLOCK1_END 0x00100000u
+
+// Throughput benchmark, on the sectors after the non-volatile variables
+#define CMD_FLASHBENCH 0x16
+#define BENCH_START (FLASH_DATA_END + 1)
+#define BENCH_SIZE FLASH_SECTOR_SIZE
+#define BENCH_CHUNK 32                                        // Bytes of test pattern generated at a time, on the stack
+#define BENCH_PATTERN(offset) ((uint8_t)((offset) ^ ((offset) >> 8))) // Every byte value, no phrase left erased
+
+// The non-volatile variables are kept as a log of records in a ring of sectors. Only the newest sector, the one with the
+// highest generation, is live. An update appends a record; when the sector is full the allocation table and the newest
+// record of each variable are copied to the next sector in the ring, which then becomes live. Each sector starts with a header phrase.
+#define LOG_MAGIC 0x33474F4Cu       // "LOG3", first word of a sector header, the second word is the generation
+#define ALLOC_TAG 0x00              // Tag of an allocation table record
+
+// A record header phrase is: tag, data length less one, check value (16 bits), then 4 bytes.
+// Variables of up to 4 bytes are kept inline in those 4 bytes. Larger variables are kept in the phrases after the header,
+// and the 4 bytes stay erased.
+// The check value covers the header and the data phrases. The header is programmed first, so the length of a torn record
+// is known and its data phrases are skipped rather than read as headers; the check value then fails.
+// An allocation table record has the variable's length less one and a check value, then its key (16 bits), tag and inverted tag.
+#define RECORD_DATA_OFFSET 4
+#define RECORD_MAX_INLINE 4
+#define RECORD_CHECK_MASK 0xFFFF0000u // Check value bits of the first word of a header
+
+#define PHRASES(size) (((size) + 7) / 8)
+#define RECORD_BYTES(size) (8 + (((size) > RECORD_MAX_INLINE) ? PHRASES(size) * 8 : 0))
+#define FOLD(sum) ((uint16_t)((sum) ^ ((sum) >> 16)))
+#define SECTOR_BASE(sector) (FLASH_DATA_START + (sector) * FLASH_SECTOR_SIZE)
+
+// Number of variables that can be allocated, tags run from 1
+#define FLASH_MAX_VARS 32
+
+// Keys given to the variables of Flash_AllocateVar, in order of allocation
+#define ORDERED_KEY_BASE 0xFF00u
 
 typedef struct
 {
@@ -40,15 +94,74 @@ typedef struct
   uint8_t DataByte7;      /*!< Stores phrase bits [7:0]   */
 } TFCCOB;
 
+// A command in the queue
+typedef struct
+{
+  TFCCOB Fccob;            /*!< The command */
+  TFlashCallback Callback; /*!< Called on completion, may be NULL */
+  void* Argument;          /*!< Passed to the callback */
+} TFlashRequest;
+
+// Completion of a blocking command
+typedef struct
+{
+  volatile BOOL Finished; /*!< Set by the callback */
+  volatile BOOL Success;  /*!< Result of the command */
+} TFlashWait;
+
+
+// A variable of the allocation table
+typedef struct
+{
+  uint16_t Key;             /*!< The caller's key, which finds the variable again after a reset */
+  uint16_t Size;            /*!< Size of the variable in bytes, 0 if the tag is free */
+  BOOL Inline;              /*!< The data is in the record header, otherwise in the phrases after it */
+  uint32_t Latest;          /*!< Address of the newest record, 0 if none */
+  uint8_t* Shadow;          /*!< RAM copy the caller's pointer points at, NULL if not allocated since start up */
+  BOOL Dirty;               /*!< The RAM copy has changed since the newest record */
+} TNvVar;
 
 // Prototypes
 static BOOL EraseSector(const uint32_t address);
 static BOOL LaunchCommand(TFCCOB* commonCommandObject);
-static BOOL AllocateVar(volatile void **data, const uint8_t end,const uint8_t size);
+static BOOL Enqueue(const TFCCOB* const fccob, TFlashCallback callback, void* argument);
+static void Start(void);
+static void Complete(void);
+static void WaitDone(void* argument, const BOOL success);
+static BOOL InterruptsMasked(void);
+static BOOL ProgramSection(const uint32_t address, const uint8_t* const data, const uint16_t nbBytes);
+static BOOL BulkRange(const uint32_t address, const uint32_t nbBytes);
+static BOOL FlashBenchHandler(void);
 static BOOL WritePhrase(const uint32_t address, const uint64_t data);
+static void Mount(void);
+static BOOL Format(const uint8_t sector, const uint32_t generation);
+static BOOL Compact(void);
+static BOOL Reserve(const uint32_t size);
+static BOOL Append(const uint8_t tag);
+static uint64_t AllocationRecord(const uint8_t tag);
+static uint32_t RecordSize(const uint8_t tag);
+static uint32_t Checksum(uint32_t sum, const uint64_t phrase);
+static uint64_t DataPhrase(const uint8_t tag, const uint16_t phrase);
+static BOOL RecordValid(const uint32_t address, const uint32_t size);
+static BOOL ShadowAllocate(const uint8_t tag, const uint8_t alignment);
+static void Load(const uint8_t tag);
+static uint8_t FindVar(const uint32_t address, const uint16_t size);
+
+static TFlashRequest Queue[FLASH_QUEUE_SIZE];   /*!< Commands waiting for the flash controller */
+static uint8_t QueueStart;                      /*!< The running command */
+static volatile uint8_t QueueCount;             /*!< Number of commands queued, including the running one */
+static OS_ECB* CommandDoneSemaphore;            /*!< Signalled when a blocking command completes */
+static OS_ECB* BlockingSemaphore;               /*!< One blocking command at a time, so CommandDoneSemaphore has one waiter */
+static OS_ECB* SectionSemaphore;                /*!< Mutual exclusion of the section program buffer */
 
-TFCCOB Fccob; /*!< Structure containing the items going into the FCCOB registers */
-static uint8_t Occupied = 0x00; /*!< Occupied space in flash memory where each bit represents a byte in a phrase */
+static TNvVar Vars[FLASH_MAX_VARS + 1];            /*!< Allocation table by tag */
+static uint64_t ShadowPool[FLASH_SHADOW_SIZE / 8]; /*!< RAM copies of the variables, phrase aligned */
+static uint16_t ShadowUsed;                        /*!< Bytes of ShadowPool allocated */
+static OS_ECB* NvSemaphore;                        /*!< Mutual exclusion of the variables and the log */
+static uint16_t NbOrdered;                         /*!< Number of variables allocated by Flash_AllocateVar */
+static uint8_t ActiveSector;                       /*!< The live sector of the ring */
+static uint32_t Generation;                        /*!< Generation of the live sector */
+static uint32_t AppendAddress;                     /*!< Where the next record goes */
 
 
 BOOL Flash_Init()
@@ -57,166 +170,575 @@ BOOL Flash_Init()
   if(ACCERR_FPVIOL_ERROR) // Check for ACCERR flag and FPVIOL flag
     FTFE_FSTAT = FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK; // Clear past errors (0x30)
 
-  return bTRUE;
+  FTFE_FCNFG &= ~FTFE_FCNFG_CCIE_MASK; // Command complete interrupt only while a command runs
+  CommandDoneSemaphore = OS_SemaphoreCreate(0);
+  BlockingSemaphore = OS_SemaphoreCreate(1);
+  NvSemaphore = OS_SemaphoreCreate(1);
+  SectionSemaphore = OS_SemaphoreCreate(1);
+  NVICICPR0 = NVIC_ICPR_CLRPEND(1 << 18); // Clear any pending interrupts on FTFE
+  NVICISER0 = NVIC_ISER_SETENA(1 << 18); // Enable interrupts on FTFE
+
+  Mount(); // Find the live sector, the allocation table and the newest record of each variable
+  return Cmd_Register(CMD_FLASHBENCH, FlashBenchHandler);
 }
 
 
-BOOL Flash_AllocateVar(volatile void** variable, const uint8_t size)
+BOOL Flash_Allocate(const uint16_t key, const uint16_t size, const uint8_t alignment, volatile void** variable)
 {
-  uint8_t position = 0;		/*!< Position in the 8 byte sector */
-  uint8_t availableSlots = 0;	/*!< Number of available positions */
-  uint8_t found = 0 ;           /*!< Number of empty locations found */
+  uint8_t tag, free = 0;
+  uint32_t live = 8, largest; /*!< Bytes a compacted sector holds: its header, the table and the newest records */
+  uint16_t used = ShadowUsed;
+  BOOL inLine, success = bFALSE;
 
-  while(position < 8) // Cycle through the locations in the sector to find free space to allocate data
+  if ((size == 0) || (size > FLASH_MAX_SIZE) || (alignment == 0) || (alignment > 8) || (alignment & (alignment - 1)))
+    return bFALSE;
+
+  inLine = (size <= RECORD_MAX_INLINE); // Alignment is that of the RAM copy
+  largest = RECORD_BYTES(size);
+
+  OS_SemaphoreWait(NvSemaphore, 0);
+
+  for (tag = 1; tag <= FLASH_MAX_VARS; tag++)
   {
-    if(CHECK_BIT(Occupied,position++) == 0) // Macro to compare each bit to find available positions
+    if (!Vars[tag].Size)
     {
-      availableSlots++; // Increase counter variable if the current array slot is empty
-      found++;
+      if (!free)
+        free = tag;
+      continue;
     }
-    else
+
+    if (Vars[tag].Key == key) // Allocated before, possibly before a reset
     {
-      found = 0; // No empty locations found
-      continue; // Return to the start of the loop to increment count
+      if ((Vars[tag].Size == size) && (Vars[tag].Inline == inLine) && !Vars[tag].Shadow && ShadowAllocate(tag, alignment))
+      {
+        Load(tag);
+        *variable = Vars[tag].Shadow;
+        success = bTRUE;
+      }
+      OS_SemaphoreSignal(NvSemaphore); // Otherwise a different layout, or allocated twice
+      return success;
     }
 
+    live += 8 + RecordSize(tag);
+    if (RecordSize(tag) > largest)
+      largest = RecordSize(tag);
+  }
 
-    if((availableSlots % size == 0) && (found == size))
+  // A compacted sector must still have room for one update of any variable
+  if (free && (live + 8 + RECORD_BYTES(size) + largest <= FLASH_SECTOR_SIZE) &&
+      Reserve(8)) // May compact, which leaves the free tag free
+  {
+    Vars[free].Key = key;
+    Vars[free].Size = size;
+    Vars[free].Inline = inLine;
+    Vars[free].Latest = 0;
+    if (ShadowAllocate(free, alignment))
     {
-      if (AllocateVar(variable,position-1,size)) // Place variable into the allocated free spaces
-        break;
-      else
-	return bFALSE;
+      AppendAddress += 8;
+      success = WritePhrase(AppendAddress - 8, AllocationRecord(free));
+    }
+
+    if (success)
+    {
+      Load(free); // Reads as erased
+      *variable = Vars[free].Shadow;
+    }
+    else
+    {
+      Vars[free].Size = 0;
+      Vars[free].Shadow = (uint8_t* )0;
+      ShadowUsed = used; // Give the RAM copy back
     }
   }
+
+  OS_SemaphoreSignal(NvSemaphore);
+  return success;
+}
+
+
+BOOL Flash_AllocateVar(volatile void** variable, const uint8_t size)
+{
+  if ((size != 1) && (size != 2) && (size != 4))
+    return bFALSE;
+
+  return Flash_Allocate(ORDERED_KEY_BASE + NbOrdered++, size, size, variable); // Keys follow the order of allocation
+}
+
+
+/*! @brief Gives a variable its RAM copy.
+ *
+ *  @param tag The variable's tag.
+ *  @param alignment The alignment of the copy.
+ *  @return BOOL - FALSE if there is no room left.
+ */
+static BOOL ShadowAllocate(const uint8_t tag, const uint8_t alignment)
+{
+  uint16_t offset = (ShadowUsed + alignment - 1) & ~(alignment - 1); /*!< ShadowPool is phrase aligned */
+
+  if (offset + Vars[tag].Size > FLASH_SHADOW_SIZE)
+    return bFALSE;
+
+  Vars[tag].Shadow = (uint8_t* )ShadowPool + offset;
+  ShadowUsed = offset + Vars[tag].Size;
   return bTRUE;
 }
 
 
-/*! @brief Allocates space for a non-volatile variable in the Flash memory
+/*! @brief Copies the data of a variable's newest record into its RAM copy, or erases the copy if it has none.
  *
- *  @param data is the address of a pointer to a variable that is to be allocated space in flash memory
- *  @param end is the position of the free starting location in the sector (position-1)
- *  @param size is the size, in bytes, of the variable that is to be allocated space in the flash memory (1, 2 or 4)
+ *  @param tag The variable's tag.
+ */
+static void Load(const uint8_t tag)
+{
+  const volatile uint8_t* record; /*!< Data of the newest record */
+  uint16_t index;
+
+  record = (const volatile uint8_t* )(Vars[tag].Latest + (Vars[tag].Inline ? RECORD_DATA_OFFSET : 8));
+  for (index = 0; index < Vars[tag].Size; index++)
+    Vars[tag].Shadow[index] = Vars[tag].Latest ? record[index] : 0xFF;
+
+  Vars[tag].Dirty = bFALSE;
+}
+
+
+/*! @brief Finds the variable that a write falls in.
  *
- *  @return BOOL - TRUE if the variable was allocated space in the Flash memory
+ *  @param address The first byte written.
+ *  @param size The number of bytes written.
+ *  @return uint8_t - The tag of the variable, 0 if the bytes are not all in one variable.
  */
-static BOOL AllocateVar(volatile void **data, const uint8_t end,const uint8_t size)
+static uint8_t FindVar(const uint32_t address, const uint16_t size)
 {
-  switch (size)
+  uint8_t tag;
+  uint32_t start;
+
+  for (tag = 1; tag <= FLASH_MAX_VARS; tag++)
   {
-    case 1:
-      *(volatile uint8_t**) data = &(_FB(FLASH_DATA_START+end)); // Starting address to place data(1 byte)
-      Occupied |= 0x1 << end; // Set flag to signal one byte being occupied
-      break;
-
-    case 2:
-      *(volatile uint16_t**) data = &(_FH(FLASH_DATA_START+(end-1))); // Starting address to place data(2 bytes)
-      Occupied |= 0x3 << end-1; // Set flag to signal two bytes being occupied
-      break;
-
-    case 4:
-      *(volatile uint32_t**) data = &(_FW(FLASH_DATA_START+(end-3))); // Starting address to place data(4 bytes)
-      Occupied |= 0xF << end-3; // Set flag to signal four bytes being occupied
-      break;
-
-    default:
-      return bFALSE; // Error
+    if (!Vars[tag].Size || !Vars[tag].Shadow)
+      continue;
+
+    start = (uint32_t)Vars[tag].Shadow;
+    if ((address >= start) && (address + size <= start + Vars[tag].Size))
+      return tag;
   }
-  return bTRUE; // Address declaration was successfully completed
+
+  return 0;
 }
 
 
-/*! @brief Writes the 64 bit phrase and the 32 bit address to the structure
+/*! @brief The number of bytes of a variable's record.
  *
- *  @return BOOL - TRUE if the Flash "data" sector was erased successfully
- *  @param address is the starting address of the data to be written at
- *  @param data is the 64 bit phrase
+ *  @param tag The variable's tag.
+ *  @return uint32_t - The header phrase and the data phrases, if any.
  */
-static BOOL WritePhrase(const uint32_t address, const uint64_t data)
+static uint32_t RecordSize(const uint8_t tag)
 {
-  Flash_Erase(); // Erase content in flash memory before writing into it
+  return RECORD_BYTES(Vars[tag].Size);
+}
 
-  Fccob.Command = FTFE_FCCOB0_CCOBn(0x07);; // Command to program phrase
-  Fccob.FlashAddress1 = address >> 16; // Bits [23:16] of starting address
-  Fccob.FlashAddress2 = address >> 8; // Bits [15:8] of starting address
-  Fccob.FlashAddress3 = address; // Bits [7:0] of starting address
 
-  Fccob.DataByte0 = data >> 56; // Store the phrase (separated into bytes) in the fccob structure
-  Fccob.DataByte1 = data >> 48;
-  Fccob.DataByte2 = data >> 40;
-  Fccob.DataByte3 = data >> 32;
-  Fccob.DataByte4 = data >> 24;
-  Fccob.DataByte5 = data >> 16;
-  Fccob.DataByte6 = data >> 8;
-  Fccob.DataByte7 = data;
+/*! @brief Builds the allocation table record of a variable.
+ *
+ *  @param tag The variable's tag.
+ *  @return uint64_t - The record phrase.
+ */
+static uint64_t AllocationRecord(const uint8_t tag)
+{
+  uint64union_t record;
 
-  return (LaunchCommand(&Fccob));
+  record.s.Lo = ALLOC_TAG | ((uint32_t)(uint8_t)(Vars[tag].Size - 1) << 8);
+  record.s.Hi = Vars[tag].Key | ((uint32_t)tag << 16) | ((uint32_t)(uint8_t)~tag << 24);
+  record.s.Lo |= (uint32_t)FOLD(Checksum(0, record.l)) << 16;
+  return record.l;
 }
 
-BOOL Flash_Write32(volatile uint32_t* const address, const uint32_t data)
+
+/*! @brief Adds a data phrase to a record checksum.
+ *
+ *  @param sum The checksum so far, 0 to start.
+ *  @param phrase The header, with its check value bits clear, or a data phrase.
+ *  @return uint32_t - The new checksum.
+ */
+static uint32_t Checksum(uint32_t sum, const uint64_t phrase)
+{
+  sum = ((sum << 5) | (sum >> 27)) ^ (uint32_t)phrase;
+  return ((sum << 5) | (sum >> 27)) ^ (uint32_t)(phrase >> 32);
+}
+
+
+/*! @brief Checks that a record was programmed completely.
+ *
+ *  @param address The record header.
+ *  @param size The number of bytes of the record, as given by its header.
+ *  @return BOOL - TRUE if the check value in the header matches the header and the data.
+ */
+static BOOL RecordValid(const uint32_t address, const uint32_t size)
+{
+  uint32_t offset, sum;
+
+  sum = Checksum(0, _FP(address) & ~(uint64_t)RECORD_CHECK_MASK);
+  for (offset = 8; offset < size; offset += 8)
+    sum = Checksum(sum, _FP(address + offset));
+
+  return (FOLD(sum) == (uint16_t)(_FW(address) >> 16));
+}
+
+
+/*! @brief Builds a phrase of a variable's data from its RAM copy.
+ *
+ *  @param tag The variable's tag.
+ *  @param phrase The index of the phrase.
+ *  @return uint64_t - The phrase, little endian, with the bytes past the variable erased.
+ */
+static uint64_t DataPhrase(const uint8_t tag, const uint16_t phrase)
+{
+  uint64_t value = 0;
+  uint16_t index;
+  int8_t i;
+
+  for (i = 7; i >= 0; i--)
+  {
+    index = phrase * 8 + i;
+    value = (value << 8) | ((index < Vars[tag].Size) ? Vars[tag].Shadow[index] : 0xFF);
+  }
+
+  return value;
+}
+
+
+/*! @brief Finds the live sector, formatting the first one if there is none, and reads its allocation table and records.
+ *
+ */
+static void Mount(void)
 {
-  uint64union_t phrase; /*!< Stores the hi and lo components of the phrase */
-  uint32_t theAddress = (uint32_t)address; /*!< Stores the starting address to store data */
+  uint32_t base, end, address, last, lo, hi, size; /*!< last is the end of the last programmed phrase */
+  uint16_t length;
+  uint8_t sector, tag;
+  BOOL found = bFALSE;
 
-  if ((theAddress/4) % 2 == 0) // Setting up a phrase
+  for (sector = 0; sector < FLASH_LOG_SECTORS; sector++) // Live sector has the highest generation
   {
-    phrase.s.Lo = data; // Combine data in address+4 with current word
-    phrase.s.Hi = _FW(theAddress+4);
-    return WritePhrase(theAddress,phrase.l); // Return 64 bit phrase
+    base = SECTOR_BASE(sector);
+    if ((_FW(base) == LOG_MAGIC) && (_FW(base + 4) != 0xFFFFFFFF) && (!found || (_FW(base + 4) > Generation)))
+    {
+      ActiveSector = sector;
+      Generation = _FW(base + 4);
+      found = bTRUE;
+    }
+  }
+
+  for (tag = 1; tag <= FLASH_MAX_VARS; tag++) // RAM copies are kept, the table is read again
+  {
+    Vars[tag].Size = 0;
+    Vars[tag].Latest = 0;
   }
-  else
+
+  if (!found)
   {
-    phrase.s.Lo = _FW(theAddress-4); // Combine data in address-4 with current word
-    phrase.s.Hi = data;
-    return WritePhrase(theAddress-4,phrase.l); // Return 64 bit phrase
+    Format(0, 1); // Blank or old layout
+    return;
   }
+
+  base = SECTOR_BASE(ActiveSector);
+  end = base + FLASH_SECTOR_SIZE;
+
+  last = base + 8; // Appending resumes after the last programmed phrase, torn records may have left some past the last record
+  address = base + 8;
+  while (address < end)
+  {
+    lo = _FW(address);
+    hi = _FW(address + 4);
+    tag = (uint8_t)lo;
+    length = (uint8_t)(lo >> 8) + 1;
+
+    if ((lo == 0xFFFFFFFF) && (hi == 0xFFFFFFFF)) // Erased, or the header of a record torn before it was started
+    {
+      address += 8;
+      continue;
+    }
+
+    last = address + 8;
+    if (tag == ALLOC_TAG)
+    {
+      tag = (uint8_t)(hi >> 16);
+      if (RecordValid(address, 8) && (tag >= 1) && (tag <= FLASH_MAX_VARS) && ((uint8_t)(hi >> 24) == (uint8_t)~tag))
+      {
+        Vars[tag].Key = (uint16_t)hi;
+        Vars[tag].Size = length;
+        Vars[tag].Inline = (length <= RECORD_MAX_INLINE);
+        Vars[tag].Latest = 0;
+      }
+      address += 8;
+      continue;
+    }
+
+    size = RECORD_BYTES(length);
+    if ((tag > FLASH_MAX_VARS) || (address + size > end)) // A torn header, the phrases after it were never programmed
+    {
+      address += 8;
+      continue;
+    }
+
+    if ((Vars[tag].Size == length) && RecordValid(address, size))
+      Vars[tag].Latest = address;
+
+    address += size; // A torn record is skipped whole, its data phrases are not headers
+    last = address; // Erased data phrases are part of the record
+  }
+
+  AppendAddress = last;
 }
 
 
-BOOL Flash_Write16(volatile uint16_t* const address, const uint16_t data)
+/*! @brief Erases a sector and makes it the live, empty sector.
+ *
+ *  @param sector The sector of the ring.
+ *  @param generation Its generation.
+ *  @return BOOL - TRUE if the sector was formatted.
+ */
+static BOOL Format(const uint8_t sector, const uint32_t generation)
 {
-  uint32union_t word; /*!< Stores the hi and lo components of the word */
-  uint32_t theAddress = (uint32_t)address; /*!< Stores the starting address to store data */
+  uint32_t base = SECTOR_BASE(sector);
+  uint64union_t header;
+
+  header.s.Lo = LOG_MAGIC;
+  header.s.Hi = generation;
+  if (!EraseSector(base) || !WritePhrase(base, header.l))
+    return bFALSE;
+
+  ActiveSector = sector;
+  Generation = generation;
+  AppendAddress = base + 8;
+  return bTRUE;
+}
+
 
-  if (theAddress % 4 == 0) // Setting up a word
+/*! @brief Copies the allocation table and the newest record of each variable to the next sector of the ring, which becomes live.
+ *
+ *  The header of the new sector is written last, so the old sector stays live until the copy is complete.
+ *  @return BOOL - TRUE if the log was compacted.
+ */
+static BOOL Compact(void)
+{
+  uint8_t target = (ActiveSector + 1) % FLASH_LOG_SECTORS; /*!< The next sector of the ring */
+  uint32_t base = SECTOR_BASE(target);
+  uint32_t address = base + 8;
+  uint32_t offset;
+  uint64union_t header;
+  uint8_t tag;
+  BOOL success;
+
+  if (!EraseSector(base))
+    return bFALSE;
+
+  success = bTRUE;
+  for (tag = 1; success && (tag <= FLASH_MAX_VARS); tag++) // Table first, so the records after it are recognised
   {
-    word.s.Lo = data; // Combine data in address+2 with current half word
-    word.s.Hi = _FH(theAddress+2);
-    return Flash_Write32(&(_FW(theAddress)),word.l); // Return 32 bit word
+    if (!Vars[tag].Size)
+      continue;
+
+    success = WritePhrase(address, AllocationRecord(tag));
+    address += 8;
   }
-  else
+
+  for (tag = 1; success && (tag <= FLASH_MAX_VARS); tag++)
   {
-    word.s.Lo = _FH(theAddress-2); // Combine data in address-2 with current half word
-    word.s.Hi = data;
-    return Flash_Write32(&(_FW(theAddress-2)),word.l); // Return 32 bit word
+    if (!Vars[tag].Size || !Vars[tag].Latest)
+      continue;
+
+    for (offset = 0; success && (offset < RecordSize(tag)); offset += 8)
+      success = WritePhrase(address + offset, _FP(Vars[tag].Latest + offset));
+    address += RecordSize(tag);
   }
+
+  header.s.Lo = LOG_MAGIC;
+  header.s.Hi = Generation + 1;
+  if (success)
+    success = WritePhrase(base, header.l);
+
+  Mount(); // The new sector if it is complete, otherwise the old one is still live
+  return success;
 }
 
 
-BOOL Flash_Write8(volatile uint8_t* const address, const uint8_t data)
+/*! @brief Makes room for a record in the live sector, compacting the log if it is full.
+ *
+ *  @param size The size of the record in bytes.
+ *  @return BOOL - TRUE if the record fits at AppendAddress.
+ */
+static BOOL Reserve(const uint32_t size)
+{
+  if (AppendAddress + size <= SECTOR_BASE(ActiveSector) + FLASH_SECTOR_SIZE)
+    return bTRUE;
+
+  return Compact() && (AppendAddress + size <= SECTOR_BASE(ActiveSector) + FLASH_SECTOR_SIZE);
+}
+
+
+/*! @brief Appends a record of a variable's RAM copy.
+ *
+ *  The header is programmed first, with the check value of the whole record, then the data phrases. A reset in between
+ *  leaves a record that fails its check, so the previous record stays the newest.
+ *  @param tag The variable's tag.
+ *  @return BOOL - TRUE if the record was written.
+ */
+static BOOL Append(const uint8_t tag)
+{
+  uint32_t address, sum;
+  uint16_t phrase;
+  uint64union_t header;
+
+  if (!Reserve(RecordSize(tag)))
+    return bFALSE;
+
+  address = AppendAddress;
+  AppendAddress += RecordSize(tag); // Phrases may be partly programmed on failure, never reuse them
+
+  header.s.Lo = tag | ((uint32_t)(uint8_t)(Vars[tag].Size - 1) << 8);
+  header.s.Hi = Vars[tag].Inline ? (uint32_t)DataPhrase(tag, 0) : 0xFFFFFFFF;
+
+  sum = Checksum(0, header.l); // Computed before anything is programmed
+  for (phrase = 0; !Vars[tag].Inline && (phrase < PHRASES(Vars[tag].Size)); phrase++)
+    sum = Checksum(sum, DataPhrase(tag, phrase));
+  header.s.Lo |= (uint32_t)FOLD(sum) << 16;
+
+  if (!WritePhrase(address, header.l))
+    return bFALSE;
+
+  for (phrase = 0; !Vars[tag].Inline && (phrase < PHRASES(Vars[tag].Size)); phrase++)
+    if (!WritePhrase(address + 8 + phrase * 8, DataPhrase(tag, phrase)))
+      return bFALSE;
+
+  Vars[tag].Latest = address;
+  Vars[tag].Dirty = bFALSE;
+  return bTRUE;
+}
+
+
+/*! @brief Programs a 64 bit phrase, which must be erased
+ *
+ *  @return BOOL - TRUE if the phrase was programmed successfully
+ *  @param address is the starting address of the data to be written at
+ *  @param data is the 64 bit phrase
+ */
+static BOOL WritePhrase(const uint32_t address, const uint64_t data)
+{
+  TFCCOB fccob; /*!< The command, local as threads program concurrently */
+
+  fccob.Command = FTFE_FCCOB0_CCOBn(0x07);; // Command to program phrase
+  fccob.FlashAddress1 = address >> 16; // Bits [23:16] of starting address
+  fccob.FlashAddress2 = address >> 8; // Bits [15:8] of starting address
+  fccob.FlashAddress3 = address; // Bits [7:0] of starting address
+
+  fccob.DataByte0 = data >> 56; // Store the phrase (separated into bytes) in the fccob structure
+  fccob.DataByte1 = data >> 48;
+  fccob.DataByte2 = data >> 40;
+  fccob.DataByte3 = data >> 32;
+  fccob.DataByte4 = data >> 24;
+  fccob.DataByte5 = data >> 16;
+  fccob.DataByte6 = data >> 8;
+  fccob.DataByte7 = data;
+
+  return (LaunchCommand(&fccob));
+}
+
+BOOL Flash_Write(volatile void* const address, const void* const data, const uint16_t size)
 {
-  uint16union_t halfWord; /*!< Stores the hi and lo components of the half word */
-  uint32_t theAddress = (uint32_t)address; /*!< Stores the starting address to store data */
+  uint8_t tag;
+  uint16_t index;
 
-  if (theAddress % 2 == 0) // Setting up a half word
+  OS_SemaphoreWait(NvSemaphore, 0);
+  tag = FindVar((uint32_t)address, size); /*!< The variable written to */
+  if (!tag || !size)
   {
-    halfWord.s.Lo = data; // Combine data in address+1 with current byte
-    halfWord.s.Hi = _FB(theAddress+1);
-    return Flash_Write16(&(_FH(theAddress)),halfWord.l); // Return 16 bit half word
+    OS_SemaphoreSignal(NvSemaphore);
+    return bFALSE;
   }
-  else
+
+  for (index = 0; index < size; index++)
   {
-    halfWord.s.Lo = _FB(theAddress-1); // Combine data in address-1 with current byte
-    halfWord.s.Hi = data;
-    return Flash_Write16(&(_FH(theAddress-1)),halfWord.l); // Return 16 bit half word
+    if (((volatile uint8_t* )address)[index] != ((const uint8_t* )data)[index]) // Writing the same value costs nothing
+    {
+      ((volatile uint8_t* )address)[index] = ((const uint8_t* )data)[index];
+      Vars[tag].Dirty = bTRUE;
+    }
   }
+
+  OS_SemaphoreSignal(NvSemaphore);
+  return bTRUE;
+}
+
+
+BOOL Flash_Commit(void)
+{
+  uint8_t tag;
+  BOOL success = bTRUE;
+
+  OS_SemaphoreWait(NvSemaphore, 0);
+  for (tag = 1; tag <= FLASH_MAX_VARS; tag++) // One record per changed variable, whatever the number of writes
+    if (Vars[tag].Size && Vars[tag].Shadow && Vars[tag].Dirty && !Append(tag))
+      success = bFALSE; // Stays dirty for the next commit
+
+  OS_SemaphoreSignal(NvSemaphore);
+  return success;
+}
+
+
+BOOL Flash_Write32(volatile uint32_t* const address, const uint32_t data)
+{
+  if ((uint32_t)address & 0x03)
+    return bFALSE;
+  return Flash_Write(address, &data, sizeof(data));
+}
+
+
+BOOL Flash_Write16(volatile uint16_t* const address, const uint16_t data)
+{
+  if ((uint32_t)address & 0x01)
+    return bFALSE;
+  return Flash_Write(address, &data, sizeof(data));
+}
+
+
+BOOL Flash_Write8(volatile uint8_t* const address, const uint8_t data)
+{
+  return Flash_Write(address, &data, sizeof(data));
 }
 
 
 BOOL Flash_Erase(void)
 {
-  return EraseSector(FLASH_DATA_START); // Erase block 2's sector 0 in flash
+  uint8_t sector, tag;
+  BOOL success = bTRUE;
+
+  OS_SemaphoreWait(NvSemaphore, 0);
+
+  for (sector = 1; success && (sector < FLASH_LOG_SECTORS); sector++) // Sector 0 is erased by formatting it
+    success = EraseSector(SECTOR_BASE(sector));
+
+  if (success)
+    success = Format(0, Generation + 1);
+
+  for (tag = 1; tag <= FLASH_MAX_VARS; tag++) // Variables allocated since start up stay allocated
+  {
+    Vars[tag].Latest = 0;
+    if (!Vars[tag].Shadow)
+      Vars[tag].Size = 0;
+    else
+      Load(tag); // Reads as erased again
+  }
+
+  for (tag = 1; success && (tag <= FLASH_MAX_VARS); tag++)
+  {
+    if (!Vars[tag].Size)
+      continue;
+
+    AppendAddress += 8;
+    success = WritePhrase(AppendAddress - 8, AllocationRecord(tag));
+  }
+
+  OS_SemaphoreSignal(NvSemaphore);
+  return success;
 }
 
 
@@ -227,45 +749,377 @@ BOOL Flash_Erase(void)
  */
 static BOOL EraseSector(const uint32_t address)
 {
-  Fccob.Command = FTFE_FCCOB0_CCOBn(0x09); // Command to erase sector
-  Fccob.FlashAddress1 = address >> 16; // Bits [23:16] of starting address
-  Fccob.FlashAddress2 = address >> 8; // Bits [15:8] of starting address
-  Fccob.FlashAddress3 = address; // Bits [7:0] of starting address
-  return LaunchCommand(&Fccob);
+  TFCCOB fccob; /*!< The command, local as threads program concurrently */
+
+  fccob.Command = FTFE_FCCOB0_CCOBn(0x09); // Command to erase sector
+  fccob.FlashAddress1 = address >> 16; // Bits [23:16] of starting address
+  fccob.FlashAddress2 = address >> 8; // Bits [15:8] of starting address
+  fccob.FlashAddress3 = address; // Bits [7:0] of starting address
+  return LaunchCommand(&fccob);
+}
+
+
+BOOL Flash_Launch(const uint8_t command, const uint32_t address, const uint64_t data, TFlashCallback callback, void* argument)
+{
+  TFCCOB fccob; /*!< The command, the phrase least significant byte first */
+
+  fccob.Command = FTFE_FCCOB0_CCOBn(command);
+  fccob.FlashAddress1 = address >> 16;
+  fccob.FlashAddress2 = address >> 8;
+  fccob.FlashAddress3 = address;
+  fccob.DataByte0 = data >> 56;
+  fccob.DataByte1 = data >> 48;
+  fccob.DataByte2 = data >> 40;
+  fccob.DataByte3 = data >> 32;
+  fccob.DataByte4 = data >> 24;
+  fccob.DataByte5 = data >> 16;
+  fccob.DataByte6 = data >> 8;
+  fccob.DataByte7 = data;
+  return Enqueue(&fccob, callback, argument);
 }
 
 
-/*! @brief Updates FCCOB registers to write to flash
+/*! @brief Runs a command and waits for it to complete.
  *
- *  @return BOOL - TRUE if the the writing was completed successfully
+ *  The calling thread blocks on a semaphore while the flash controller works, so other threads keep running.
+ *  With interrupts masked, as during start up, it polls instead. Threads calling it together take turns,
+ *  otherwise one could take the completion signal of the other.
+ *  @return BOOL - TRUE if the the command was completed successfully
  *  @param commonCommandObject is the structure which contains the stored values
  */
 static BOOL LaunchCommand(TFCCOB* commonCommandObject)
 {
+  TFlashWait wait; /*!< Filled in by the completion callback */
+
+  wait.Finished = bFALSE;
+  wait.Success = bFALSE;
+
+  OS_SemaphoreWait(BlockingSemaphore, 0);
+  while (!Enqueue(commonCommandObject, WaitDone, &wait)) // Queue full of asynchronous commands
+  {
+    if (InterruptsMasked())
+    {
+      while(!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK)) {}
+      Complete();
+    }
+    else
+      OS_TimeDelay(1);
+  }
+
+  while (!wait.Finished)
+  {
+    if (InterruptsMasked())
+    {
+      while(!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK)) {} // Wait for command completion
+      Complete();
+    }
+    else
+      OS_SemaphoreWait(CommandDoneSemaphore, 0); // May also wake for an earlier polled command, hence the loop
+  }
+
+  OS_SemaphoreSignal(BlockingSemaphore);
+  return wait.Success;
+}
+
+
+/*! @brief Completion callback of a blocking command.
+ *
+ *  @param argument The caller's TFlashWait.
+ *  @param success TRUE if the command completed without error.
+ */
+static void WaitDone(void* argument, const BOOL success)
+{
+  ((TFlashWait* )argument)->Success = success;
+  ((TFlashWait* )argument)->Finished = bTRUE;
+  OS_SemaphoreSignal(CommandDoneSemaphore);
+}
+
+
+/*! @brief Adds a command to the queue, starting it if the flash controller is idle.
+ *
+ *  @param fccob The command.
+ *  @param callback Called on completion, may be NULL.
+ *  @param argument Passed to the callback.
+ *  @return BOOL - FALSE if the queue is full.
+ */
+static BOOL Enqueue(const TFCCOB* const fccob, TFlashCallback callback, void* argument)
+{
+  TFlashRequest* request;
+
+  EnterCritical(); // Shared with the ISR
+  if (QueueCount == FLASH_QUEUE_SIZE)
+  {
+    ExitCritical();
+    return bFALSE;
+  }
+
+  request = &Queue[(QueueStart + QueueCount) % FLASH_QUEUE_SIZE];
+  request->Fccob = *fccob;
+  request->Callback = callback;
+  request->Argument = argument;
+  QueueCount++;
+  if (QueueCount == 1)
+    Start();
+  ExitCritical();
+  return bTRUE;
+}
+
+
+/*! @brief Launches the command at the head of the queue.
+ *
+ *  @note Called with the queue locked.
+ */
+static void Start(void)
+{
+  TFCCOB* fccob = &Queue[QueueStart].Fccob;
+
   if(ACCERR_FPVIOL_ERROR) // Check for ACCERR flag and FPVIOL flag
     FTFE_FSTAT = FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK; // Clear past errors (0x30)
 
-  FTFE_FCCOB0 = commonCommandObject->Command; // Place structure content into FCCOB registers
-  FTFE_FCCOB1 = commonCommandObject->FlashAddress1;
-  FTFE_FCCOB2 = commonCommandObject->FlashAddress2;
-  FTFE_FCCOB3 = commonCommandObject->FlashAddress3;
+  FTFE_FCCOB0 = fccob->Command; // Place structure content into FCCOB registers
+  FTFE_FCCOB1 = fccob->FlashAddress1;
+  FTFE_FCCOB2 = fccob->FlashAddress2;
+  FTFE_FCCOB3 = fccob->FlashAddress3;
 
-  FTFE_FCCOB8 = commonCommandObject->DataByte0;
-  FTFE_FCCOB9 = commonCommandObject->DataByte1;
-  FTFE_FCCOBA = commonCommandObject->DataByte2;
-  FTFE_FCCOBB = commonCommandObject->DataByte3;
-  FTFE_FCCOB4 = commonCommandObject->DataByte4;
-  FTFE_FCCOB5 = commonCommandObject->DataByte5;
-  FTFE_FCCOB6 = commonCommandObject->DataByte6;
-  FTFE_FCCOB7 = commonCommandObject->DataByte7;
+  FTFE_FCCOB8 = fccob->DataByte0;
+  FTFE_FCCOB9 = fccob->DataByte1;
+  FTFE_FCCOBA = fccob->DataByte2;
+  FTFE_FCCOBB = fccob->DataByte3;
+  FTFE_FCCOB4 = fccob->DataByte4;
+  FTFE_FCCOB5 = fccob->DataByte5;
+  FTFE_FCCOB6 = fccob->DataByte6;
+  FTFE_FCCOB7 = fccob->DataByte7;
 
   FTFE_FSTAT = FTFE_FSTAT_CCIF_MASK; // Launch command sequence
-  while(!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK)) // Wait for command completion
-  {}
+  FTFE_FCNFG |= FTFE_FCNFG_CCIE_MASK; // Interrupt when it completes
+}
+
+
+/*! @brief Finishes the running command and launches the next one.
+ *
+ *  @note Called from the ISR, or polled with interrupts masked, once CCIF is set.
+ */
+static void Complete(void)
+{
+  TFlashRequest request;
+  BOOL success;
+
+  EnterCritical();
+  FTFE_FCNFG &= ~FTFE_FCNFG_CCIE_MASK; // CCIF stays set while idle
+  if (QueueCount == 0)
+  {
+    ExitCritical();
+    return;
+  }
+
+  success = !(FTFE_FSTAT & COMMAND_ERROR);
+  request = Queue[QueueStart];
+  QueueStart = (QueueStart + 1) % FLASH_QUEUE_SIZE;
+  QueueCount--;
+  if (QueueCount)
+    Start(); // Keep the controller busy
+  ExitCritical();
+
+  if (request.Callback)
+    request.Callback(request.Argument, success);
+}
+
+
+/*! @brief Checks whether the command complete interrupt can be taken.
+ *
+ *  @return BOOL - TRUE if interrupts are masked, by OS_DisableInterrupts or EnterCritical.
+ */
+static BOOL InterruptsMasked(void)
+{
+  uint32_t primask, faultmask;
+
+  __asm ("MRS %[output], PRIMASK" : [output] "=r" (primask));
+  __asm ("MRS %[output], FAULTMASK" : [output] "=r" (faultmask));
+  return ((primask | faultmask) & 1);
+}
+
+
+void __attribute__ ((interrupt)) FTFE_ISR(void)
+{
+  OS_ISREnter(); // Start of servicing interrupt
+  Complete();
+  OS_ISRExit(); // End of servicing interrupt
+}
+
+
+/*! @brief Checks that a bulk operation stays in the part of block 1 left to it.
+ *
+ *  @param address The first byte.
+ *  @param nbBytes The number of bytes.
+ *  @return BOOL - TRUE if the range is in block 1 and clear of the non-volatile variables.
+ */
+static BOOL BulkRange(const uint32_t address, const uint32_t nbBytes)
+{
+  if ((address < BLOCK1_START) || (address > BLOCK1_END) || (nbBytes > BLOCK1_END - address))
+    return bFALSE;
+
+  return (address > FLASH_DATA_END) || (address + nbBytes <= FLASH_DATA_START);
+}
+
+
+BOOL Flash_EraseRange(const uint32_t address, const uint32_t nbBytes)
+{
+  uint32_t offset;
+
+  if ((address % FLASH_SECTOR_SIZE) || (nbBytes % FLASH_SECTOR_SIZE) || !BulkRange(address, nbBytes))
+    return bFALSE;
+
+  for (offset = 0; offset < nbBytes; offset += FLASH_SECTOR_SIZE)
+    if (!EraseSector(address + offset))
+      return bFALSE;
+
+  return bTRUE;
+}
+
+
+BOOL Flash_ProgramPhrases(const uint32_t address, const uint8_t* const data, const uint32_t nbBytes)
+{
+  uint32_t offset;
+  uint64_t value;
+  int8_t i;
+
+  if ((address & 0x07) || !BulkRange(address, nbBytes))
+    return bFALSE;
+
+  for (offset = 0; offset < nbBytes; offset += 8)
+  {
+    value = 0;
+    for (i = 7; i >= 0; i--) // Little endian, a partial last phrase is padded with erased bytes
+      value = (value << 8) | ((offset + i < nbBytes) ? data[offset + i] : 0xFF);
+
+    if (!WritePhrase(address + offset, value))
+      return bFALSE;
+  }
+
   return bTRUE;
 }
 
 
+BOOL Flash_ProgramBlock(const uint32_t address, const uint8_t* const data, const uint32_t nbBytes)
+{
+  uint32_t offset = 0, chunk;
+
+  if ((address & 0x07) || !BulkRange(address, nbBytes))
+    return bFALSE;
+
+  if (!(FTFE_FCNFG & FTFE_FCNFG_RAMRDY_MASK)) // FlexRAM is EEPROM, no section program buffer
+    return Flash_ProgramPhrases(address, data, nbBytes);
+
+  if ((address % SECTION_ALIGN) && (nbBytes > 0)) // Leading phrase up to the section alignment
+  {
+    chunk = (nbBytes < 8) ? nbBytes : 8;
+    if (!Flash_ProgramPhrases(address, data, chunk))
+      return bFALSE;
+    offset = chunk;
+  }
+
+  while (nbBytes - offset >= SECTION_ALIGN)
+  {
+    chunk = (nbBytes - offset) & ~(SECTION_ALIGN - 1);
+    if (chunk > SECTION_SIZE)
+      chunk = SECTION_SIZE;
+
+    if (!ProgramSection(address + offset, data + offset, chunk))
+      return bFALSE;
+    offset += chunk;
+  }
+
+  if (offset < nbBytes) // Trailing phrase
+    return Flash_ProgramPhrases(address + offset, data + offset, nbBytes - offset);
+
+  return bTRUE;
+}
+
+
+/*! @brief Copies data into the section program buffer and programs it with one command.
+ *
+ *  @param address Where to program, aligned to SECTION_ALIGN.
+ *  @param data The data.
+ *  @param nbBytes The number of bytes, a multiple of SECTION_ALIGN up to SECTION_SIZE.
+ *  @return BOOL - TRUE if the data was programmed.
+ */
+static BOOL ProgramSection(const uint32_t address, const uint8_t* const data, const uint16_t nbBytes)
+{
+  volatile uint8_t* buffer = (volatile uint8_t* )FLEXRAM_START;
+  uint16_t nbPhrases = nbBytes / 8;
+  TFCCOB fccob; /*!< The command */
+  uint16_t i;
+  BOOL success;
+
+  OS_SemaphoreWait(SectionSemaphore, 0); // The buffer holds one section at a time
+  for (i = 0; i < nbBytes; i++) // Same byte order as the Flash
+    buffer[i] = data[i];
+
+  fccob.Command = FTFE_FCCOB0_CCOBn(FLASH_CMD_PROGRAM_SECTION);
+  fccob.FlashAddress1 = address >> 16;
+  fccob.FlashAddress2 = address >> 8;
+  fccob.FlashAddress3 = address;
+  fccob.DataByte4 = nbPhrases >> 8; // FCCOB4 and FCCOB5, the number of phrases
+  fccob.DataByte5 = nbPhrases;
+  fccob.DataByte6 = 0;
+  fccob.DataByte7 = 0;
+  fccob.DataByte0 = 0;
+  fccob.DataByte1 = 0;
+  fccob.DataByte2 = 0;
+  fccob.DataByte3 = 0;
+
+  success = LaunchCommand(&fccob);
+  OS_SemaphoreSignal(SectionSemaphore);
+  return success;
+}
+
+
+/*! @brief Command 0x16 : flash - program throughput.
+ *
+ *  Erases the benchmark sectors and programs one sector with Program Phrase, from a test pattern generated a chunk at a time,
+ *  then copies it to the next sector with Program Section. Replies with the two rates in bytes per second, least significant byte first.
+ *  @return BOOL - TRUE if both sectors were programmed and read back and the rates were sent.
+ */
+static BOOL FlashBenchHandler(void)
+{
+  uint32_t start, rate[2];
+  uint8_t chunk[BENCH_CHUNK]; /*!< Part of the test pattern */
+  uint8_t payload[8];
+  uint32_t i, offset;
+  BOOL success = bTRUE;
+
+  if (!Flash_EraseRange(BENCH_START, 2 * BENCH_SIZE))
+    return bFALSE;
+
+  start = DWT_CYCCNT;
+  for (offset = 0; success && (offset < BENCH_SIZE); offset += BENCH_CHUNK) // One command per phrase either way
+  {
+    for (i = 0; i < BENCH_CHUNK; i++)
+      chunk[i] = BENCH_PATTERN(offset + i);
+    success = Flash_ProgramPhrases(BENCH_START + offset, chunk, BENCH_CHUNK);
+  }
+  rate[0] = DWT_CYCCNT - start;
+
+  start = DWT_CYCCNT;
+  success = success && Flash_ProgramBlock(BENCH_START + BENCH_SIZE, (const uint8_t* )BENCH_START, BENCH_SIZE); // Copied to the section buffer before each command
+  rate[1] = DWT_CYCCNT - start;
+
+  for (i = 0; success && (i < BENCH_SIZE); i++)
+    success = (_FB(BENCH_START + i) == BENCH_PATTERN(i)) && (_FB(BENCH_START + BENCH_SIZE + i) == BENCH_PATTERN(i));
+
+  if (!success)
+    return bFALSE;
+
+  for (i = 0; i < 2; i++)
+    rate[i] = (uint32_t)(((uint64_t)BENCH_SIZE * CPU_CORE_CLK_HZ) / (rate[i] ? rate[i] : 1)); // Cycles to bytes per second
+
+  for (i = 0; i < sizeof(payload); i++)
+    payload[i] = (uint8_t)(rate[i / 4] >> (8 * (i % 4)));
+
+  return Packet_PutExtended(CMD_FLASHBENCH, payload, sizeof(payload));
+}
+
+
 /*!
  * @}
 */
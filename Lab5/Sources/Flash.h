@@ -20,39 +20,76 @@
 #define _FW(flashAddress)  *(uint32_t volatile *)(flashAddress)
 #define _FP(flashAddress)  *(uint64_t volatile *)(flashAddress)
 
+// Size of a Flash sector, the smallest block that can be erased
+#define FLASH_SECTOR_SIZE 0x1000LU
+// Number of sectors the non-volatile variables are wear-levelled across
+#define FLASH_LOG_SECTORS 2
+// Largest non-volatile variable in bytes
+#define FLASH_MAX_SIZE 256
+// RAM kept for the copies of the non-volatile variables, in bytes
+#define FLASH_SHADOW_SIZE 1024
+
+// FTFE commands for Flash_Launch
+#define FLASH_CMD_PROGRAM_PHRASE 0x07
+#define FLASH_CMD_ERASE_SECTOR 0x09
+
+// Called when a command started by Flash_Launch completes, from the interrupt
+typedef void (*TFlashCallback)(void* argument, const BOOL success);
+
 // Address of the start of the Flash block we are using for data storage
 #define FLASH_DATA_START 0x00080000LU
 // Address of the end of the Flash block we are using for data storage
-#define FLASH_DATA_END   0x00080007LU
+#define FLASH_DATA_END   (FLASH_DATA_START + FLASH_LOG_SECTORS * FLASH_SECTOR_SIZE - 1)
 
 
 /*! @brief Enables the Flash module.
  *
  *  @return BOOL - TRUE if the Flash was setup successfully.
+ *  @note Assumes that Cmd_Init has been called, the programming benchmark command is registered here.
  */
 BOOL Flash_Init(void);
  
+/*! @brief Allocates space for a non-volatile variable of any size, found again by its key after a reset.
+ *
+ *  @param key Identifies the variable. Keys from 0xFF00 are used by Flash_AllocateVar.
+ *  @param size The size, in bytes, of the variable, up to FLASH_MAX_SIZE.
+ *  @param alignment The alignment, in bytes, of the variable: 1, 2, 4 or 8.
+ *  @param variable is the address of a pointer to the variable.
+ *         The pointer is set to a RAM copy of the variable's latest value, which does not move.
+ *         The variable reads as erased (all bits set) until it is first written.
+ *  @return BOOL - TRUE if the variable was allocated, or found with the same size. FALSE if the key was allocated
+ *          with another size or the Flash is full.
+ *  @note Assumes Flash has been initialized. The allocation table is kept in Flash, so a key keeps its value across resets.
+ */
+BOOL Flash_Allocate(const uint16_t key, const uint16_t size, const uint8_t alignment, volatile void** variable);
+
 /*! @brief Allocates space for a non-volatile variable in the Flash memory.
  *
  *  @param variable is the address of a pointer to a variable that is to be allocated space in Flash memory.
- *         The pointer will be allocated to a relevant address:
- *         If the variable is a byte, then any address.
- *         If the variable is a half-word, then an even address.
- *         If the variable is a word, then an address divisible by 4.
- *         This allows the resulting variable to be used with the relevant Flash_Write function which assumes a certain memory address.
- *         e.g. a 16-bit variable will be on an even address
+ *         The pointer is set to a RAM copy of the variable's latest value, which is aligned to its size and does not move.
+ *         The variable reads as erased (all bits set) until it is first written.
  *  @param size The size, in bytes, of the variable that is to be allocated space in the Flash memory. Valid values are 1, 2 and 4.
  *  @return BOOL - TRUE if the variable was allocated space in the Flash memory.
- *  @note Assumes Flash has been initialized.
+ *  @note Assumes Flash has been initialized. Variables must be allocated in the same order on every start up.
  */
 BOOL Flash_AllocateVar(volatile void** variable, const uint8_t size);
 
+/*! @brief Writes bytes of a non-volatile variable to its RAM copy.
+ *
+ *  @param address The address of the first byte, in a variable allocated since start up.
+ *  @param data The bytes to write.
+ *  @param size The number of bytes, which must all be in the same variable.
+ *  @return BOOL - TRUE if the bytes were written, FALSE if they are not in one allocated variable.
+ *  @note Assumes Flash has been initialized. The variable is programmed to Flash by the next Flash_Commit.
+ */
+BOOL Flash_Write(volatile void* const address, const void* const data, const uint16_t size);
+
 /*! @brief Writes a 32-bit number to Flash.
  *
  *  @param address The address of the data.
  *  @param data The 32-bit data to write.
- *  @return BOOL - TRUE if Flash was written successfully, FALSE if address is not aligned to a 4-byte boundary or if there is a programming error.
- *  @note Assumes Flash has been initialized.
+ *  @return BOOL - TRUE if the data was written, FALSE if address is not aligned to a 4-byte boundary or not in an allocated variable.
+ *  @note Assumes Flash has been initialized. The data is programmed to Flash by the next Flash_Commit.
  */
 BOOL Flash_Write32(volatile uint32_t* const address, const uint32_t data);
  
@@ -60,8 +97,8 @@ BOOL Flash_Write32(volatile uint32_t* const address, const uint32_t data);
  *
  *  @param address The address of the data.
  *  @param data The 16-bit data to write.
- *  @return BOOL - TRUE if Flash was written successfully, FALSE if address is not aligned to a 2-byte boundary or if there is a programming error.
- *  @note Assumes Flash has been initialized.
+ *  @return BOOL - TRUE if the data was written, FALSE if address is not aligned to a 2-byte boundary or not in an allocated variable.
+ *  @note Assumes Flash has been initialized. The data is programmed to Flash by the next Flash_Commit.
  */
 BOOL Flash_Write16(volatile uint16_t* const address, const uint16_t data);
 
@@ -69,16 +106,77 @@ BOOL Flash_Write16(volatile uint16_t* const address, const uint16_t data);
  *
  *  @param address The address of the data.
  *  @param data The 8-bit data to write.
- *  @return BOOL - TRUE if Flash was written successfully, FALSE if there is a programming error.
- *  @note Assumes Flash has been initialized.
+ *  @return BOOL - TRUE if the data was written, FALSE if address is not in an allocated variable.
+ *  @note Assumes Flash has been initialized. The data is programmed to Flash by the next Flash_Commit.
  */
 BOOL Flash_Write8(volatile uint8_t* const address, const uint8_t data);
 
-/*! @brief Erases the entire Flash sector.
+/*! @brief Programs every variable written since the last commit, one record each however many writes it had.
+ *
+ *  @return BOOL - TRUE if all of them were programmed. Variables that failed are tried again by the next commit.
+ *  @note Assumes Flash has been initialized. Blocks the calling thread for the programming time, and for a sector
+ *        erase when the log is compacted.
+ */
+BOOL Flash_Commit(void);
+
+/*! @brief Erases every non-volatile variable.
  *
- *  @return BOOL - TRUE if the Flash "data" sector was erased successfully.
+ *  @return BOOL - TRUE if the Flash "data" sectors were erased successfully.
  *  @note Assumes Flash has been initialized.
  */
 BOOL Flash_Erase(void);
 
+/*! @brief Erases whole sectors of program flash block 1, outside the non-volatile variables.
+ *
+ *  @param address The first sector, aligned to FLASH_SECTOR_SIZE.
+ *  @param nbBytes The number of bytes, a multiple of FLASH_SECTOR_SIZE.
+ *  @return BOOL - TRUE if the sectors were erased.
+ *  @note Assumes Flash has been initialized.
+ */
+BOOL Flash_EraseRange(const uint32_t address, const uint32_t nbBytes);
+
+/*! @brief Programs a block of erased program flash with the Program Section command.
+ *
+ *  The data is staged in the FlexRAM section program buffer, up to 4 KiB per command, so large blocks such as
+ *  firmware images or recorded logs program at the controller's rate. Falls back to Program Phrase when the
+ *  FlexRAM is used as EEPROM, and for the unaligned first and last phrase.
+ *  @param address Where to program, aligned to a phrase, in block 1 outside the non-volatile variables.
+ *  @param data The data.
+ *  @param nbBytes The number of bytes. A partial last phrase is padded with erased bytes.
+ *  @return BOOL - TRUE if the block was programmed.
+ *  @note Assumes Flash has been initialized and the range erased.
+ */
+BOOL Flash_ProgramBlock(const uint32_t address, const uint8_t* const data, const uint32_t nbBytes);
+
+/*! @brief Programs a block of erased program flash one phrase per command.
+ *
+ *  @param address Where to program, aligned to a phrase, in block 1 outside the non-volatile variables.
+ *  @param data The data.
+ *  @param nbBytes The number of bytes. A partial last phrase is padded with erased bytes.
+ *  @return BOOL - TRUE if the block was programmed.
+ *  @note Assumes Flash has been initialized and the range erased.
+ */
+BOOL Flash_ProgramPhrases(const uint32_t address, const uint8_t* const data, const uint32_t nbBytes);
+
+/*! @brief Queues an FTFE command and returns without waiting for it.
+ *
+ *  @param command FLASH_CMD_PROGRAM_PHRASE or FLASH_CMD_ERASE_SECTOR.
+ *  @param address The phrase or sector address.
+ *  @param data The phrase to program, least significant byte at the address.
+ *  @param callback Called from the interrupt when the command completes, may be NULL.
+ *  @param argument Passed to the callback.
+ *  @return BOOL - FALSE if the command queue is full.
+ *  @note Assumes Flash has been initialized. The addresses used by the non-volatile variables must be left alone,
+ *        and the Flash block must not be read until the command completes.
+ */
+BOOL Flash_Launch(const uint8_t command, const uint32_t address, const uint64_t data, TFlashCallback callback, void* argument);
+
+/*! @brief Interrupt service routine for the FTFE.
+ *
+ *  The running command has completed.
+ *  Its callback is called and the next queued command is launched.
+ *  @note Assumes the Flash has been initialized.
+ */
+void __attribute__ ((interrupt)) FTFE_ISR(void);
+
 #endif
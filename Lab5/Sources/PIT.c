@@ -32,6 +32,9 @@ BOOL PIT_Init(const uint32_t moduleClk)
   PIT_MCR &= ~PIT_MCR_FRZ_MASK; // Run timers when in debug mode (PIT_MCR = 0)
   PIT_MCR &= ~PIT_MCR_MDIS_MASK; // Enable clock for PIT
 
+  PIT_LDVAL1 = 0xFFFFFFFF; // PIT1 counts down through the whole 32-bit range as a time stamp, no interrupts
+  PIT_TCTRL1 = PIT_TCTRL_TEN_MASK;
+
   NVICICPR2 |= NVIC_ICPR_CLRPEND(1 << 4); // Clear pending interrupts on PIT module
   NVICISER2 |= NVIC_ISER_SETENA(1 << 4); // Enable interrupts on PIT module
 
@@ -62,6 +65,12 @@ void PIT_Enable(const BOOL enable)
 }
 
 
+uint32_t PIT_Timestamp(void)
+{
+  return ~PIT_CVAL1; // Count up instead of down
+}
+
+
 void __attribute__ ((interrupt)) PIT_ISR(void)
 {
   OS_ISREnter(); // Start of servicing interrupt
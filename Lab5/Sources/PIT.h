@@ -38,6 +38,14 @@ void PIT_Set(const uint32_t period, const BOOL restart);
  */
 void PIT_Enable(const BOOL enable);
 
+/*! @brief Reads the free running time stamp counter.
+ *
+ *  PIT1 counts module clock periods from PIT_Init and wraps every 2^32 periods, so differences of time stamps are valid across a wrap.
+ *  @return uint32_t - The number of module clock periods since PIT_Init.
+ *  @note Assumes the PIT has been initialized.
+ */
+uint32_t PIT_Timestamp(void);
+
 /*! @brief Interrupt service routine for the PIT.
  *
  *  The periodic interrupt timer has timed out.
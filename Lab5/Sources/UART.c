@@ -15,144 +15,1258 @@
 
 // Included header files
 #include "OS.h"
+#include "Cpu.h"
 #include "PE_Types.h"
 #include "types.h"
 #include "MK70F12.h"
 #include "FIFO.h"
+#include "PIT.h"
+#include "UART.h"
 
 
 // Arbitrary thread stack size - big enough for stacking of interrupts and OS use.
 #define THREAD_STACK_SIZE 100
 
+// Size of each of the two receive DMA buffers
+#define RX_DMA_BUFFER_SIZE 64
+
+// Largest acceptable difference between the requested and the achievable baud rate, in percent
+#define BAUD_RATE_MAX_ERROR 2
+
+// Depth in bytes of a hardware FIFO from its PFIFO size field
+#define HW_FIFO_DEPTH(size) ((size) ? (1 << ((size) + 1)) : 1)
+
+// RxFIFO level at or below which a paused receiver resumes emptying the hardware FIFO
+#define RX_RESUME_LEVEL (FIFO_SIZE / 2)
+
+// Number of frame ends remembered per transmit lane, beyond which the newest ones are merged
+#define TX_LANE_MARKS 8
+
+// Number of received batches whose arrival time is remembered, beyond which new batches join the newest one
+#define RX_MARKS 16
+
+// Number of OS ticks a change of line settings waits for the transmitter to drain before giving up
+#define TX_IDLE_TIMEOUT 1000
+
+// Largest number of bytes in one DMA block, the size of the CITER field
+#define DMA_MAX_BLOCK 0x7FFF
+
+// Exception numbers of the first external interrupt, also DMA channel 0
+#define VECTOR_IRQ_BASE 16
+
+// Fixed resources of one UART
+typedef struct
+{
+  UART_MemMapPtr base;          /*!< UART registers */
+  volatile uint32_t *scgc;      /*!< SIM clock gate register for the UART */
+  uint32_t scgcMask;            /*!< Clock gate bit for the UART */
+  uint32_t portMask;            /*!< SIM_SCGC5 clock gate bit for the port the pins are on */
+  volatile uint32_t *txPCR;     /*!< Transmit pin control register */
+  volatile uint32_t *rxPCR;     /*!< Receive pin control register */
+  volatile uint32_t *rtsPCR;    /*!< Request to send pin control register */
+  volatile uint32_t *ctsPCR;    /*!< Clear to send pin control register */
+  uint8_t irq;                  /*!< RX_TX interrupt number, the ERR interrupt is the next one */
+  uint8_t txDMAChannel;         /*!< eDMA channel that drains the transmit FIFO */
+  uint8_t rxDMAChannel;         /*!< eDMA channel that fills the receive buffers */
+  uint8_t txDMASource;          /*!< DMAMUX request source for the transmitter */
+  uint8_t rxDMASource;          /*!< DMAMUX request source for the receiver */
+} TUARTHardware;
+
+// One transmit lane of a UART
+typedef struct
+{
+  TFIFO FIFO;                                  /*!< Bytes waiting to be transmitted */
+  uint32_t Written;                            /*!< Number of bytes ever put in the FIFO */
+  volatile uint32_t Sent;                      /*!< Number of bytes ever taken from the FIFO by the DMA channel */
+  uint32_t Marks[TX_LANE_MARKS];               /*!< Values of Written at the frame ends not yet sent, oldest first */
+  volatile uint8_t MarkHead;                   /*!< Index of the oldest mark */
+  volatile uint8_t MarkCount;                  /*!< Number of marks */
+  uint32_t LastMark;                           /*!< The last frame end sent, equal to Sent between frames */
+} TUARTTxLane;
+
+// Arrival of a batch of received bytes
+typedef struct
+{
+  uint16_t Start;                              /*!< RxFIFO End index of the first byte of the batch */
+  uint32_t Time;                               /*!< PIT time stamp of its arrival */
+} TUARTRxMark;
+
+// Run-time state of one UART
+typedef struct
+{
+  uint32_t ReceiveThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08))); /*!< The stack for the receive thread */
+  const TUARTHardware *Hardware;               /*!< Fixed resources of the UART */
+  BOOL Initialized;                            /*!< TRUE once UART_Init has been called */
+  TUARTTxLane TxLane[UART_NB_LANES];          /*!< Transmit lanes */
+  volatile TUARTLane TxActiveLane;             /*!< The lane the transmitter is sending from */
+  volatile BOOL TxHold;                        /*!< TRUE while the bulk lane may not start a new frame or block */
+  TFIFO RxFIFO;                                /*!< Received bytes waiting to be read */
+  OS_ECB *ReceiveSemaphore;                    /*!< Binary semaphore for signaling receiving of data */
+  volatile uint16_t TxDMACount;                /*!< Number of bytes in the DMA block currently being transmitted, 0 if the channel is idle */
+  const uint8_t * volatile TxBlock;            /*!< Next byte of the block being sent in place by UART_OutBlock */
+  volatile uint32_t TxBlockCount;              /*!< Number of bytes of that block not yet sent, 0 if none */
+  OS_ECB *TxBlockSemaphore;                    /*!< Binary semaphore for signaling that the block has been sent */
+  TUARTRxMode RxMode;                          /*!< Current receive mode */
+  uint8_t RxDMABuffer[2][RX_DMA_BUFFER_SIZE];  /*!< Ping-pong buffers filled by the receive DMA channel */
+  volatile uint16_t RxDMASpan[2];              /*!< Number of received bytes waiting in each buffer, 0 if the buffer is free */
+  uint8_t RxDMAIndex;                          /*!< The buffer currently being filled by the receive DMA channel */
+  uint8_t RxDMAReadIndex;                      /*!< The next buffer to be emptied by the receive thread */
+  uint32_t RxDMATime[2];                       /*!< Time stamp of the hand over of each buffer */
+  volatile uint32_t RxIntTime;                 /*!< Time stamp of the byte in the data register in UART_RX_INT mode */
+  TUARTRxMark RxMarks[RX_MARKS];               /*!< Arrival of the batches in the RxFIFO not yet read, oldest first */
+  volatile uint8_t RxMarkHead;                 /*!< Index of the oldest mark */
+  volatile uint8_t RxMarkCount;                /*!< Number of marks */
+  uint32_t RxTime;                             /*!< Arrival time stamp of the last byte read */
+  uint8_t RxHWFIFODepth;                       /*!< Depth of the hardware receive FIFO */
+  uint8_t TxHWFIFODepth;                       /*!< Depth of the hardware transmit FIFO */
+  uint8_t RxWatermark;                         /*!< Receive FIFO level that raises an interrupt in UART_RX_FIFO mode */
+  uint16_t RxWakeLevel;                        /*!< RxFIFO level that wakes the reader in the modes that receive inside UART_ISR */
+  BOOL FlowControl;                            /*!< TRUE if RTS and CTS are in use */
+  BOOL MultiDrop;                              /*!< TRUE on an RS-485 bus, with RTS as the transceiver enable */
+  volatile BOOL RxPaused;                      /*!< TRUE while UART_ISR leaves bytes in the hardware FIFO because the RxFIFO is nearly full */
+  uint32_t ModuleClk;                          /*!< The module clock rate in Hz */
+  TUARTStats Stats;                            /*!< Traffic and line error counters */
+  volatile uint32_t LineErrors;                /*!< Total of the line error counters */
+} TUARTState;
+
 // Prototypes
 static void ReceiveThread(void* pData);
-static void TransmitThread(void* pData);
+static void TxDMAStart(TUARTState* const uart);
+static BOOL TxLaneBetweenFrames(TUARTTxLane* const lane);
+static BOOL TxIdle(const TUARTState* const uart);
+static BOOL TxIdleEnterCritical(TUARTState* const uart);
+static void TxBlockStart(TUARTState* const uart);
+static void TxDMAProgram(TUARTState* const uart, const uint8_t* const span, const uint16_t count);
+static void RxDMASwap(TUARTState* const uart);
+static void RxHWFIFODrain(TUARTState* const uart);
+static uint16_t BaudRateDivisor(const TUARTState* const uart, const uint32_t baudRate);
+static void SetBaudRateDivisor(const TUARTState* const uart, const uint16_t baudRateDivisor);
+static void RxErrorRecover(TUARTState* const uart, const uint8_t status);
+static void RxResume(TUARTState* const uart);
+static void RxMark(TUARTState* const uart, const uint32_t time);
+static void RxTimeUpdate(TUARTState* const uart);
+static TUARTState* ActiveUART(void);
+static TUARTState* ActiveDMAUART(const BOOL transmit);
 
-// Variable Declarations
-static uint32_t TransmitThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08))); /*!< The stack for the transmit thread. */
-static uint32_t ReceiveThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08))); /*!< The stack for the receive thread */
-static OS_ECB *TransmitSemaphore; /*!< Binary semaphore for signaling that data transmission */
-static OS_ECB *ReceiveSemaphore;  /*!< Binary semaphore for signaling receiving of data */
+// Pin routing is the TWR-K70F120M default for each UART, all on ALT3
+// DMA channels are paired transmit (even) and receive (odd), UART2 keeps channels 0 and 1
+static const TUARTHardware UARTHardware[UART_NB_INSTANCES] =
+{
+  {UART0_BASE_PTR, &SIM_SCGC4, SIM_SCGC4_UART0_MASK, SIM_SCGC5_PORTB_MASK, &PORTB_PCR17, &PORTB_PCR16, &PORTB_PCR2, &PORTB_PCR3, 45, 2, 3, 3, 2},
+  {UART1_BASE_PTR, &SIM_SCGC4, SIM_SCGC4_UART1_MASK, SIM_SCGC5_PORTC_MASK, &PORTC_PCR4, &PORTC_PCR3, &PORTC_PCR1, &PORTC_PCR2, 47, 4, 5, 5, 4},
+  {UART2_BASE_PTR, &SIM_SCGC4, SIM_SCGC4_UART2_MASK, SIM_SCGC5_PORTE_MASK, &PORTE_PCR16, &PORTE_PCR17, &PORTE_PCR19, &PORTE_PCR18, 49, 0, 1, 7, 6},
+  {UART3_BASE_PTR, &SIM_SCGC4, SIM_SCGC4_UART3_MASK, SIM_SCGC5_PORTC_MASK, &PORTC_PCR17, &PORTC_PCR16, &PORTC_PCR18, &PORTC_PCR19, 51, 6, 7, 9, 8},
+  {UART4_BASE_PTR, &SIM_SCGC1, SIM_SCGC1_UART4_MASK, SIM_SCGC5_PORTE_MASK, &PORTE_PCR24, &PORTE_PCR25, &PORTE_PCR27, &PORTE_PCR26, 53, 8, 9, 11, 10},
+  {UART5_BASE_PTR, &SIM_SCGC1, SIM_SCGC1_UART5_MASK, SIM_SCGC5_PORTE_MASK, &PORTE_PCR8, &PORTE_PCR9, &PORTE_PCR11, &PORTE_PCR10, 55, 10, 11, 13, 12}
+};
 
-extern TFIFO TxFIFO;
-extern TFIFO RxFIFO;
+// Variable Declarations
+static TUARTState UARTState[UART_NB_INSTANCES]; /*!< Run-time state of each UART */
 
 
-BOOL UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+BOOL UART_Init(const TUARTInstance instance, const uint32_t baudRate, const uint32_t moduleClk, const uint8_t threadPriority)
 {
   OS_ERROR error;             /*!< Thread content */
+  TUARTState *uart;           /*!< The UART being set up */
+  UART_MemMapPtr base;        /*!< Its registers */
+  uint8_t txChannel, rxChannel;
+  uint8_t lane;
+
+  if (instance >= UART_NB_INSTANCES)
+    return bFALSE;
+
+  uart = &UARTState[instance];
+  uart->Hardware = &UARTHardware[instance];
+  base = uart->Hardware->base;
+  txChannel = uart->Hardware->txDMAChannel;
+  rxChannel = uart->Hardware->rxDMAChannel;
+
+  *uart->Hardware->scgc |= uart->Hardware->scgcMask; // Enable clock gate for the UART module
+  SIM_SCGC5 |= uart->Hardware->portMask; // Enable clock gate for the port to enable pin routing
+  *uart->Hardware->txPCR = PORT_PCR_MUX(3); // Transmitter pin select
+  *uart->Hardware->rxPCR = PORT_PCR_MUX(3); // Receiver pin select
+
+  UART_C2_REG(base) = 0x00; // Transmitter and receiver off while the UART is configured
+  UART_C1_REG(base) = 0x00; // Configuration for UART
+  UART_MODEM_REG(base) = 0x00; // No flow control until UART_SetFlowControl is called
+  UART_C4_REG(base) &= ~(UART_C4_MAEN1_MASK | UART_C4_MAEN2_MASK); // No address matching until UART_SetMultiDrop is called
+
+  uart->RxHWFIFODepth = HW_FIFO_DEPTH((UART_PFIFO_REG(base) & UART_PFIFO_RXFIFOSIZE_MASK) >> UART_PFIFO_RXFIFOSIZE_SHIFT); // Hardware FIFO depths are fixed per UART instance
+  uart->TxHWFIFODepth = HW_FIFO_DEPTH((UART_PFIFO_REG(base) & UART_PFIFO_TXFIFOSIZE_MASK) >> UART_PFIFO_TXFIFOSIZE_SHIFT);
+  uart->RxWatermark = 1;
+  uart->RxWakeLevel = 1;
+  uart->FlowControl = bFALSE;
+  uart->MultiDrop = bFALSE;
+  uart->RxPaused = bFALSE;
 
-  uint16_t sbr,     	      /*!< The SBR value */
-	   baudRateDivisor;   /*!< The SBR and BRFD value as a whole number */
+  UART_PFIFO_REG(base) |= UART_PFIFO_RXFE_MASK | UART_PFIFO_TXFE_MASK; // Enable hardware FIFOs, only allowed while TE and RE are clear
+  UART_CFIFO_REG(base) = UART_CFIFO_RXFLUSH_MASK | UART_CFIFO_TXFLUSH_MASK; // Start with empty hardware FIFOs
+  UART_RWFIFO_REG(base) = UART_RWFIFO_RXWATER(1); // RDRF as soon as one byte arrives until UART_RX_FIFO is selected
+  UART_TWFIFO_REG(base) = UART_TWFIFO_TXWATER(uart->TxHWFIFODepth - 1); // Request more data whenever there is room in the hardware FIFO
 
-  uint8_t brfa;      	      /*!< The BRFA bits */
+  UART_C2_REG(base) |= UART_C2_TE_MASK; // Enable transmitting
+  UART_C2_REG(base) |= UART_C2_RE_MASK; // Enable receiving (0x0C)
+  UART_C2_REG(base) |= UART_C2_RIE_MASK; // Receive(RDRF) interrupt enable
+  UART_C2_REG(base) &= ~UART_C2_TIE_MASK; // Transmit interrupt disabled until there is data to send
+  UART_C5_REG(base) |= UART_C5_TDMAS_MASK; // TDRE raises DMA requests instead of interrupts
+  UART_C3_REG(base) |= UART_C3_ORIE_MASK | UART_C3_NEIE_MASK | UART_C3_FEIE_MASK | UART_C3_PEIE_MASK; // Line errors raise the ERR interrupt
 
-  SIM_SCGC4 |= SIM_SCGC4_UART2_MASK; // Enable clock gate for UART2 module
-  SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK; // Enable clock gate for PortE to enable pin routing
-  PORTE_PCR16 = PORT_PCR_MUX(3); // Transmitter pin select
-  PORTE_PCR17 = PORT_PCR_MUX(3); // Receiver pin select
+  uart->ModuleClk = moduleClk; // Needed to change the baud rate later
+  SetBaudRateDivisor(uart, BaudRateDivisor(uart, baudRate)); // Program SBR and BRFA
 
-  UART2_C1 = 0x00; // Configuration for UART
+  FIFO_Init(&uart->RxFIFO); // Initialize receiver FIFO
+  uart->RxMarkHead = 0;
+  uart->RxMarkCount = 0;
+  uart->RxTime = 0;
+  for (lane = 0; lane < UART_NB_LANES; lane++) // Initialize transmitter FIFOs
+  {
+    FIFO_Init(&uart->TxLane[lane].FIFO);
+    uart->TxLane[lane].Written = 0;
+    uart->TxLane[lane].Sent = 0;
+    uart->TxLane[lane].MarkHead = 0;
+    uart->TxLane[lane].MarkCount = 0;
+    uart->TxLane[lane].LastMark = 0;
+  }
+  uart->TxActiveLane = UART_LANE_CONTROL;
+  uart->TxHold = bFALSE;
+
+  uart->TxDMACount = 0; // Transmit DMA channel is idle
+  uart->TxBlockCount = 0;
+  uart->RxMode = UART_RX_INT; // Receive one byte per interrupt until another mode is selected
+  uart->Stats.rxBytes = 0;
+  uart->Stats.txBytes = 0;
+  uart->Stats.rxDropped = 0;
+  uart->Stats.overruns = 0;
+  uart->Stats.noiseErrors = 0;
+  uart->Stats.framingErrors = 0;
+  uart->Stats.parityErrors = 0;
+  uart->LineErrors = 0;
+
+  uart->ReceiveSemaphore = OS_SemaphoreCreate(0); // Receive semaphore initialized to 0
+  uart->TxBlockSemaphore = OS_SemaphoreCreate(0);
+  uart->Initialized = bTRUE; // The shared interrupts may now serve this UART
+
+  NVIC_ICPR_REG(NVIC_BASE_PTR, uart->Hardware->irq / 32) = NVIC_ICPR_CLRPEND(1 << (uart->Hardware->irq % 32)); // Clear any pending interrupts on the UART
+  NVIC_ISER_REG(NVIC_BASE_PTR, uart->Hardware->irq / 32) = NVIC_ISER_SETENA(1 << (uart->Hardware->irq % 32));  // Enable interrupts on the UART
+  NVIC_ICPR_REG(NVIC_BASE_PTR, (uart->Hardware->irq + 1) / 32) = NVIC_ICPR_CLRPEND(1 << ((uart->Hardware->irq + 1) % 32)); // Same for the error interrupt
+  NVIC_ISER_REG(NVIC_BASE_PTR, (uart->Hardware->irq + 1) / 32) = NVIC_ISER_SETENA(1 << ((uart->Hardware->irq + 1) % 32));
+
+  SIM_SCGC6 |= SIM_SCGC6_DMAMUX0_MASK; // Enable clock gate for DMAMUX module
+  SIM_SCGC7 |= SIM_SCGC7_DMA_MASK; // Enable clock gate for eDMA module
+
+  DMAMUX0_CHCFG(txChannel) = 0; // Disable the channel while it is configured
+  DMA_CERQ = DMA_CERQ_CERQ(txChannel); // No hardware requests until there is data to send
 
-  UART2_C2 |= UART_C2_TE_MASK; // Enable transmitting
-  UART2_C2 |= UART_C2_RE_MASK; // Enable receiving (0x0C)
-  UART2_C2 |= UART_C2_RIE_MASK; // Receive(RDRF) interrupt enable
-  UART2_C2 &= ~UART_C2_TIE_MASK; // Transmission complete interrupt enable
+  DMA_SOFF_REG(DMA_BASE_PTR, txChannel) = 1; // Step through the FIFO buffer one byte at a time
+  DMA_ATTR_REG(DMA_BASE_PTR, txChannel) = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0); // 8-bit source and destination
+  DMA_NBYTES_MLNO_REG(DMA_BASE_PTR, txChannel) = 1; // One byte per UART request
+  DMA_SLAST_REG(DMA_BASE_PTR, txChannel) = 0; // Source address is reloaded for every block
+  DMA_DADDR_REG(DMA_BASE_PTR, txChannel) = (uint32_t)&UART_D_REG(base); // Always write to the data register
+  DMA_DOFF_REG(DMA_BASE_PTR, txChannel) = 0;
+  DMA_DLAST_SGA_REG(DMA_BASE_PTR, txChannel) = 0;
+  DMA_CSR_REG(DMA_BASE_PTR, txChannel) = DMA_CSR_INTMAJOR_MASK | DMA_CSR_DREQ_MASK; // Interrupt and stop at the end of each block
 
-  baudRateDivisor = (moduleClk * 2) / baudRate; // Calculation to deduce SBR and BRFA
+  DMAMUX0_CHCFG(txChannel) = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(uart->Hardware->txDMASource); // Route transmit requests to the channel
 
-  brfa = baudRateDivisor % 32; // Calculation of BRFA
-  UART2_C4 = UART_C4_BRFA(brfa); // BRFA values is stored into the register
+  DMAMUX0_CHCFG(rxChannel) = 0; // Receive channel stays disabled until UART_RX_DMA is selected
+  DMA_CERQ = DMA_CERQ_CERQ(rxChannel);
 
-  sbr = baudRateDivisor / 32; // Value for baud rate setting(SBR) is calculated
+  DMA_SADDR_REG(DMA_BASE_PTR, rxChannel) = (uint32_t)&UART_D_REG(base); // Always read from the data register
+  DMA_SOFF_REG(DMA_BASE_PTR, rxChannel) = 0;
+  DMA_ATTR_REG(DMA_BASE_PTR, rxChannel) = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0); // 8-bit source and destination
+  DMA_NBYTES_MLNO_REG(DMA_BASE_PTR, rxChannel) = 1; // One byte per UART request
+  DMA_SLAST_REG(DMA_BASE_PTR, rxChannel) = 0;
+  DMA_DOFF_REG(DMA_BASE_PTR, rxChannel) = 1; // Step through the receive buffer one byte at a time
+  DMA_DLAST_SGA_REG(DMA_BASE_PTR, rxChannel) = 0; // Destination address is reloaded for every buffer
+  DMA_CSR_REG(DMA_BASE_PTR, rxChannel) = DMA_CSR_INTMAJOR_MASK | DMA_CSR_DREQ_MASK; // Interrupt and stop when a buffer is full
 
-  UART2_BDH |= 0x1F & (sbr >> 8); // 5 most significant bits of SBR is written to baud rate register(high)
-  UART2_BDL = sbr; // 8 least significant bits of SBR is written to baud rate register(low)
+  NVICICPR0 = NVIC_ICPR_CLRPEND((1 << txChannel) | (1 << rxChannel)); // Clear any pending interrupts on the DMA channels
+  NVICISER0 = NVIC_ISER_SETENA((1 << txChannel) | (1 << rxChannel));  // Enable interrupts on the DMA channels
 
-  NVICICPR1 = NVIC_ICPR_CLRPEND(1 << 17); // Clear any pending interrupts on UART2
-  NVICISER1 = NVIC_ISER_SETENA(1 << 17);  // Enable interrupts on UART2
+  error = OS_ThreadCreate(ReceiveThread, // One receive thread per UART
+                          uart,
+                          &uart->ReceiveThreadStack[THREAD_STACK_SIZE - 1],
+                          threadPriority);
+  return (error == OS_NO_ERROR);
+}
+
+
+/*! @brief Calculates the combined SBR and BRFA value that best matches a baud rate.
+ *
+ *  @param uart The UART.
+ *  @param baudRate The desired baud rate in bits/sec.
+ *  @return uint16_t - SBR * 32 + BRFA, or 0 if the baud rate cannot be reached within BAUD_RATE_MAX_ERROR.
+ */
+static uint16_t BaudRateDivisor(const TUARTState* const uart, const uint32_t baudRate)
+{
+  uint32_t baudRateDivisor; /*!< The SBR and BRFD value as a whole number */
+  uint32_t actual;          /*!< The baud rate the divisor produces */
+  uint32_t error;           /*!< Difference between the desired and the actual baud rate */
 
-  FIFO_Init(&RxFIFO); // Initialize receiver FIFO
-  FIFO_Init(&TxFIFO); // Initialize transmitter FIFO
+  if (baudRate == 0)
+    return 0;
 
-  ReceiveSemaphore = OS_SemaphoreCreate(0); // Receive semaphore initialized to 0
-  TransmitSemaphore = OS_SemaphoreCreate(0); // Transmit semaphore initialized to 0
+  baudRateDivisor = ((uart->ModuleClk * 2) + (baudRate / 2)) / baudRate; // Baud = moduleClk / (16 * (SBR + BRFA / 32)), rounded to nearest
+
+  if ((baudRateDivisor < 32) || (baudRateDivisor > 0xFFFF)) // SBR must be between 1 and 8191
+    return 0;
+
+  actual = (uart->ModuleClk * 2) / baudRateDivisor;
+  error = (actual > baudRate) ? (actual - baudRate) : (baudRate - actual);
+
+  if (error * 100 > baudRate * BAUD_RATE_MAX_ERROR) // Too far off for the other end to sample reliably
+    return 0;
+
+  return baudRateDivisor;
+}
+
+
+/*! @brief Writes the SBR and BRFA fields.
+ *
+ *  @param uart The UART.
+ *  @param baudRateDivisor SBR * 32 + BRFA, as returned by BaudRateDivisor.
+ */
+static void SetBaudRateDivisor(const TUARTState* const uart, const uint16_t baudRateDivisor)
+{
+  UART_MemMapPtr base = uart->Hardware->base; /*!< The UART registers */
+  uint16_t sbr = baudRateDivisor / 32;        /*!< The SBR value */
+  uint8_t brfa = baudRateDivisor % 32;        /*!< The BRFA bits */
+
+  UART_C4_REG(base) = (UART_C4_REG(base) & ~UART_C4_BRFA_MASK) | UART_C4_BRFA(brfa); // BRFA values is stored into the register
+  UART_BDH_REG(base) = (UART_BDH_REG(base) & ~UART_BDH_SBR_MASK) | UART_BDH_SBR(sbr >> 8); // 5 most significant bits of SBR, buffered until BDL is written
+  UART_BDL_REG(base) = (uint8_t)sbr; // 8 least significant bits of SBR, the new rate takes effect
+}
 
-  error = OS_ThreadCreate(ReceiveThread, // 2nd highest priority thread
-                          NULL,
-                          &ReceiveThreadStack[THREAD_STACK_SIZE - 1],
-                          1);
 
-  error = OS_ThreadCreate(TransmitThread, // 3rd highest priority thread
-                          NULL,
-                          &TransmitThreadStack[THREAD_STACK_SIZE - 1],
-                          2);
+BOOL UART_CheckBaudRate(const TUARTInstance instance, const uint32_t baudRate)
+{
+  return (BaudRateDivisor(&UARTState[instance], baudRate) != 0);
+}
+
+
+BOOL UART_SetBaudRate(const TUARTInstance instance, const uint32_t baudRate)
+{
+  TUARTState *uart = &UARTState[instance];                    /*!< The UART */
+  uint16_t baudRateDivisor = BaudRateDivisor(uart, baudRate); /*!< The SBR and BRFD value as a whole number */
+
+  if (baudRateDivisor == 0) // Not achievable from the module clock
+    return bFALSE;
+
+  if (!TxIdleEnterCritical(uart)) // Let everything queued go out at the old rate
+    return bFALSE;
+  SetBaudRateDivisor(uart, baudRateDivisor);
+  TxDMAStart(uart); // Bulk data held back during the wait goes out at the new rate
+  ExitCritical(); // End of critical section
+
   return bTRUE;
 }
 
 
-BOOL UART_InChar(uint8_t * const dataPtr)
+/*! @brief Lets the receive interrupt empty the hardware FIFO again once a paused RxFIFO has drained far enough.
+ *
+ *  @param uart The UART.
+ *  @note Must be called by the reader after removing data from the RxFIFO.
+ */
+static void RxResume(TUARTState* const uart)
 {
-  return FIFO_Get(&RxFIFO, dataPtr); // Gets oldest byte from RxFIFO
+  if (uart->RxPaused && (FIFO_Count(&uart->RxFIFO) <= RX_RESUME_LEVEL)) // Enough room again, let the hardware FIFO drain
+  {
+    EnterCritical(); // Start of critical section
+    uart->RxPaused = bFALSE;
+    if ((uart->RxMode == UART_RX_FIFO) || (uart->RxMode == UART_RX_ISR))
+      UART_C2_REG(uart->Hardware->base) |= UART_C2_RIE_MASK | UART_C2_ILIE_MASK;
+    ExitCritical(); // End of critical section
+  }
 }
 
 
-BOOL UART_OutChar(const uint8_t data)
+BOOL UART_InChar(const TUARTInstance instance, uint8_t * const dataPtr)
 {
-  FIFO_Put(&TxFIFO, data); // Put byte into TxFIFO
-  UART2_C2 |= UART_C2_TIE_MASK; // Enable transmit interrupt
+  TUARTState *uart = &UARTState[instance]; /*!< The UART */
+  BOOL success;                            /*!< TRUE if a byte was read */
+
+  success = FIFO_Get(&uart->RxFIFO, dataPtr); // Gets oldest byte from RxFIFO
+  RxTimeUpdate(uart);
+  RxResume(uart);
+
+  return success;
+}
+
+
+uint16_t UART_InChars(const TUARTInstance instance, uint8_t * const data, const uint16_t nbBytes)
+{
+  TUARTState *uart = &UARTState[instance]; /*!< The UART */
+  uint16_t count;                          /*!< Number of bytes read */
+
+  count = FIFO_GetN(&uart->RxFIFO, data, nbBytes); // Whatever is already there
+  if (count)
+    RxTimeUpdate(uart);
+  RxResume(uart);
+
+  return count;
+}
+
+
+uint32_t UART_RxTimestamp(const TUARTInstance instance)
+{
+  return UARTState[instance].RxTime;
 }
 
 
-/*! @brief Thread that looks after receiving data.
+/*! @brief Remembers when the bytes about to be put into the RxFIFO arrived.
  *
- *  @param pData Thread parameter.
- *  @note Assumes that semaphores are created and communicate properly.
+ *  @param uart The UART.
+ *  @param time PIT time stamp of their arrival.
+ *  @note Must be called by the producer of the RxFIFO, from the UART interrupt or with interrupts disabled.
  */
-static void ReceiveThread(void* pData)
+static void RxMark(TUARTState* const uart, const uint32_t time)
+{
+  TUARTRxMark *mark; /*!< The new mark */
+
+  if (uart->RxMarkCount == RX_MARKS) // Reader is far behind, the bytes join the newest batch
+    return;
+
+  mark = &uart->RxMarks[(uart->RxMarkHead + uart->RxMarkCount) % RX_MARKS];
+  mark->Start = uart->RxFIFO.End;
+  mark->Time = time;
+  uart->RxMarkCount++;
+}
+
+
+/*! @brief Moves RxTime on to the arrival of the last byte read, dropping the marks of the batches reached.
+ *
+ *  @param uart The UART.
+ *  @note Must be called by the reader after removing data from the RxFIFO.
+ */
+static void RxTimeUpdate(TUARTState* const uart)
+{
+  EnterCritical(); // Marks are added by the UART interrupt and the receive thread
+  while (uart->RxMarkCount && ((int16_t)(uart->RxMarks[uart->RxMarkHead].Start - uart->RxFIFO.Start) < 0)) // First byte of the batch has been read
+  {
+    uart->RxTime = uart->RxMarks[uart->RxMarkHead].Time;
+    uart->RxMarkHead = (uart->RxMarkHead + 1) % RX_MARKS;
+    uart->RxMarkCount--;
+  }
+  ExitCritical();
+}
+
+
+void UART_WaitForData(const TUARTInstance instance)
+{
+  FIFO_Wait(&UARTState[instance].RxFIFO);
+}
+
+
+BOOL UART_OutChar(const TUARTInstance instance, const uint8_t data)
+{
+  UART_OutLane(instance, UART_LANE_CONTROL, &data, 1, bTRUE);
+  return bTRUE;
+}
+
+
+void UART_OutChars(const TUARTInstance instance, const uint8_t * const data, const uint16_t nbBytes)
 {
+  UART_OutLane(instance, UART_LANE_CONTROL, data, nbBytes, bTRUE);
+}
+
+
+void UART_OutLane(const TUARTInstance instance, const TUARTLane lane, const uint8_t * const data, const uint16_t nbBytes, const BOOL endOfFrame)
+{
+  TUARTState *uart = &UARTState[instance];    /*!< The UART */
+  TUARTTxLane *txLane = &uart->TxLane[lane];  /*!< The lane */
+  uint16_t count = 0;                         /*!< Number of bytes queued so far */
+  uint8_t last;                               /*!< Index of the newest mark */
+
+  while (count < nbBytes)
+  {
+    count += FIFO_PutN(&txLane->FIFO, &data[count], nbBytes - count); // Queue as much as fits in one go
+
+    if (count < nbBytes)
+    {
+      EnterCritical(); // The DMA completion interrupt also starts blocks
+      TxDMAStart(uart);
+      ExitCritical();
+
+      FIFO_Put(&txLane->FIFO, data[count++]); // FIFO is full, wait for space with interrupts enabled
+    }
+  }
+  txLane->Written += nbBytes;
+
+  EnterCritical(); // Marks are removed by the DMA completion interrupt
+  if (endOfFrame)
+  {
+    if (txLane->MarkCount < TX_LANE_MARKS)
+      txLane->MarkCount++;
+    last = (txLane->MarkHead + txLane->MarkCount - 1) % TX_LANE_MARKS; // When full, the newest frame end absorbs the one before
+    txLane->Marks[last] = txLane->Written;
+  }
+  TxDMAStart(uart); // Start draining if the channel is idle
+  ExitCritical();
+}
+
+
+void UART_OutBlock(const TUARTInstance instance, const uint8_t * const data, const uint32_t nbBytes)
+{
+  TUARTState *uart = &UARTState[instance]; /*!< The UART */
+
+  if (nbBytes == 0)
+    return;
+
   for (;;)
   {
-    OS_SemaphoreWait(ReceiveSemaphore, 0); // Wait for receive semaphore to signal
-    FIFO_Put(&RxFIFO, UART2_D); // Put byte into RxFIFO
-    UART2_C2 |= UART_C2_RIE_MASK; // Re-enable receive interrupt
+    EnterCritical(); // The channel must be idle and stay so until the block owns it
+    if (!uart->TxHold && !uart->TxDMACount && !FIFO_Count(&uart->TxLane[UART_LANE_BULK].FIFO) && // Everything queued before the block has gone to the UART
+        ((uart->TxActiveLane == UART_LANE_BULK) || TxLaneBetweenFrames(&uart->TxLane[uart->TxActiveLane])))
+    {
+      uart->TxActiveLane = UART_LANE_BULK;
+      uart->TxBlock = data;
+      uart->TxBlockCount = nbBytes;
+      TxBlockStart(uart);
+      ExitCritical();
+      break;
+    }
+    ExitCritical();
+
+    OS_TimeDelay(1);
+  }
+
+  OS_SemaphoreWait(uart->TxBlockSemaphore, 0); // Sleep until the DMA completion interrupt has sent the last part
+}
+
+
+void UART_GetStats(const TUARTInstance instance, TUARTStats* const stats)
+{
+  EnterCritical(); // Counters are updated from interrupts
+  *stats = UARTState[instance].Stats;
+  ExitCritical();
+}
+
+
+uint16_t UART_TxPending(const TUARTInstance instance, const TUARTLane lane)
+{
+  return FIFO_Count(&UARTState[instance].TxLane[lane].FIFO);
+}
+
+
+uint32_t UART_LineErrors(const TUARTInstance instance)
+{
+  return UARTState[instance].LineErrors;
+}
+
+
+/*! @brief Checks whether the transmitter may leave a lane, removing the frame ends it has reached.
+ *
+ *  @param lane The lane.
+ *  @return BOOL - TRUE if the last byte taken from the lane ended a frame.
+ *  @note Must be called with interrupts disabled or from the DMA completion interrupt, with the channel idle.
+ */
+static BOOL TxLaneBetweenFrames(TUARTTxLane* const lane)
+{
+  while (lane->MarkCount && (lane->Marks[lane->MarkHead] == lane->Sent))
+  {
+    lane->LastMark = lane->Sent;
+    lane->MarkHead = (lane->MarkHead + 1) % TX_LANE_MARKS;
+    lane->MarkCount--;
+  }
+
+  return (lane->Sent == lane->LastMark);
+}
+
+
+/*! @brief Checks whether everything that has to be sent before a change of line settings has been transmitted.
+ *
+ *  @param uart The UART.
+ *  @return BOOL - TRUE if the channel and the control lane are empty, the bulk lane is between frames, and the last stop bit has gone out.
+ *  @note Bytes waiting in the bulk lane while it is held do not count, they are sent after the change.
+ */
+static BOOL TxIdle(const TUARTState* const uart)
+{
+  return !uart->TxDMACount && !FIFO_Count(&uart->TxLane[UART_LANE_CONTROL].FIFO) &&
+         ((uart->TxActiveLane == UART_LANE_CONTROL) || (uart->TxLane[UART_LANE_BULK].Sent == uart->TxLane[UART_LANE_BULK].LastMark)) &&
+         (UART_S1_REG(uart->Hardware->base) & UART_S1_TC_MASK);
+}
+
+
+/*! @brief Waits until the transmitter has drained, then enters a critical section.
+ *
+ *  The bulk lane is held at its next frame end during the wait, so a steady stream of bulk data cannot keep the transmitter busy.
+ *  The transmitter is checked again with interrupts disabled, so nothing can be queued between the check and the caller's change.
+ *  @param uart The UART.
+ *  @return BOOL - TRUE if the transmitter drained, FALSE if it was still busy after TX_IDLE_TIMEOUT ticks.
+ *  @note On success the caller must call TxDMAStart to release the bulk lane, then ExitCritical.
+ */
+static BOOL TxIdleEnterCritical(TUARTState* const uart)
+{
+  uint16_t ticks;
+
+  uart->TxHold = bTRUE; // Only read between frames, so it takes effect at the next frame end
+
+  for (ticks = 0; ticks <= TX_IDLE_TIMEOUT; ticks++)
+  {
+    EnterCritical(); // Start of critical section
+    if (TxIdle(uart))
+    {
+      uart->TxHold = bFALSE;
+      return bTRUE;
+    }
+    ExitCritical(); // End of critical section
+
+    OS_TimeDelay(1);
+  }
+
+  EnterCritical(); // Start of critical section
+  uart->TxHold = bFALSE;
+  TxDMAStart(uart); // Carry on with the held bulk data at the old settings
+  ExitCritical(); // End of critical section
+
+  return bFALSE;
+}
+
+
+/*! @brief Starts a DMA block from the lane chosen by the scheduler.
+ *
+ *  The transmitter stays on its lane until the end of the current frame. Between frames the control lane has strict priority.
+ *  A block never runs past the next frame end, so the choice is made again after every frame.
+ *  @param uart The UART.
+ *  @note Must be called with interrupts disabled or from the DMA completion interrupt.
+ *        Does nothing if a block is already in progress or there is nothing to send.
+ */
+static void TxDMAStart(TUARTState* const uart)
+{
+  TUARTTxLane *lane = &uart->TxLane[uart->TxActiveLane]; /*!< The lane to send from */
+  uint8_t *span;   /*!< Oldest byte in the lane FIFO */
+  uint16_t count;  /*!< Number of bytes in the next block */
+  uint8_t index;
+
+  if (uart->TxDMACount) // Channel busy
+    return;
+
+  if (TxLaneBetweenFrames(lane)) // Free to change lane
+  {
+    for (index = 0; index < UART_NB_LANES; index++) // Lanes in priority order
+      if (FIFO_Count(&uart->TxLane[index].FIFO) && !(uart->TxHold && (index == UART_LANE_BULK)))
+        break;
+    if (index == UART_NB_LANES) // Nothing to send
+      return;
+
+    uart->TxActiveLane = (TUARTLane)index;
+    lane = &uart->TxLane[index];
+  }
+
+  count = FIFO_PeekRead(&lane->FIFO, &span); // Largest contiguous run, the wrapped part is sent in the next block
+  if (count == 0) // Rest of the frame not written yet
+    return;
+
+  if (lane->MarkCount && (count > lane->Marks[lane->MarkHead] - lane->Sent))
+    count = lane->Marks[lane->MarkHead] - lane->Sent; // Stop at the frame end to choose the lane again
+
+  TxDMAProgram(uart, span, count);
+}
+
+
+/*! @brief Starts a DMA block covering the next part of the block given to UART_OutBlock.
+ *
+ *  @param uart The UART.
+ *  @note Must be called with interrupts disabled or from the DMA completion interrupt, with the channel idle.
+ */
+static void TxBlockStart(TUARTState* const uart)
+{
+  uint16_t count = (uart->TxBlockCount > DMA_MAX_BLOCK) ? DMA_MAX_BLOCK : (uint16_t)uart->TxBlockCount; /*!< Number of bytes in the next DMA block */
+
+  TxDMAProgram(uart, uart->TxBlock, count); // Read straight from the caller's memory
+}
+
+
+/*! @brief Points the transmit DMA channel at a run of bytes and starts it.
+ *
+ *  @param uart The UART.
+ *  @param span The first byte.
+ *  @param count The number of bytes, at most DMA_MAX_BLOCK.
+ *  @note Must be called with interrupts disabled or from the DMA completion interrupt, with the channel idle.
+ */
+static void TxDMAProgram(TUARTState* const uart, const uint8_t* const span, const uint16_t count)
+{
+  uint8_t channel = uart->Hardware->txDMAChannel; /*!< The transmit DMA channel */
+
+  uart->TxDMACount = count;
+
+  DMA_CDNE = DMA_CDNE_CDNE(channel); // Clear DONE from the previous block
+  DMA_SADDR_REG(DMA_BASE_PTR, channel) = (uint32_t)span;
+  DMA_CITER_ELINKNO_REG(DMA_BASE_PTR, channel) = DMA_CITER_ELINKNO_CITER(count); // One major loop iteration per byte
+  DMA_BITER_ELINKNO_REG(DMA_BASE_PTR, channel) = DMA_BITER_ELINKNO_BITER(count);
+  DMA_SERQ = DMA_SERQ_SERQ(channel); // Accept requests from the UART
+
+  UART_C2_REG(uart->Hardware->base) |= UART_C2_TIE_MASK; // TDRE requests the DMA channel
+}
+
+
+void UART_SetRxMode(const TUARTInstance instance, const TUARTRxMode rxMode)
+{
+  TUARTState *uart = &UARTState[instance];               /*!< The UART */
+  UART_MemMapPtr base = uart->Hardware->base;            /*!< Its registers */
+  uint8_t channel = uart->Hardware->rxDMAChannel;        /*!< The receive DMA channel */
+  TUARTRxMode mode = rxMode;                             /*!< The mode actually selected */
+
+  if (uart->MultiDrop && (mode == UART_RX_DMA)) // DMA cannot tell address characters from data
+    mode = UART_RX_ISR;
+
+  EnterCritical(); // Start of critical section
+
+  if (uart->RxMode == UART_RX_DMA)
+  {
+    RxDMASwap(uart); // Hand over whatever is sitting in the current buffer
+    DMA_CERQ = DMA_CERQ_CERQ(channel); // Stop the receive DMA channel
+    DMAMUX0_CHCFG(channel) = 0;
+    UART_C5_REG(base) &= ~UART_C5_RDMAS_MASK; // RDRF raises interrupts again
+  }
+
+  UART_C2_REG(base) &= ~UART_C2_ILIE_MASK; // Idle line interrupt disabled
+  UART_RWFIFO_REG(base) = UART_RWFIFO_RXWATER(1); // RDRF as soon as one byte arrives
+  FIFO_SetWakeLevel(&uart->RxFIFO, 1); // Thread producers have no idle line to flush a partial batch
+
+  uart->RxMode = mode;
+  uart->RxPaused = bFALSE;
+
+  if (mode == UART_RX_DMA)
+  {
+    uart->RxDMAIndex = 0; // Start filling the first buffer
+    uart->RxDMAReadIndex = 0;
+    uart->RxDMASpan[0] = 0;
+    uart->RxDMASpan[1] = 0;
+
+    DMA_CDNE = DMA_CDNE_CDNE(channel);
+    DMA_DADDR_REG(DMA_BASE_PTR, channel) = (uint32_t)uart->RxDMABuffer[0];
+    DMA_CITER_ELINKNO_REG(DMA_BASE_PTR, channel) = DMA_CITER_ELINKNO_CITER(RX_DMA_BUFFER_SIZE);
+    DMA_BITER_ELINKNO_REG(DMA_BASE_PTR, channel) = DMA_BITER_ELINKNO_BITER(RX_DMA_BUFFER_SIZE);
+    DMAMUX0_CHCFG(channel) = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(uart->Hardware->rxDMASource); // Route receive requests to the channel
+    DMA_SERQ = DMA_SERQ_SERQ(channel);
+
+    UART_C1_REG(base) |= UART_C1_ILT_MASK; // Idle character count starts after the stop bit
+    UART_C5_REG(base) |= UART_C5_RDMAS_MASK; // RDRF raises DMA requests instead of interrupts
+    UART_C2_REG(base) |= UART_C2_RIE_MASK | UART_C2_ILIE_MASK; // DMA requests and idle line interrupt enabled
+  }
+  else if ((mode == UART_RX_FIFO) || (mode == UART_RX_ISR))
+  {
+    if (mode == UART_RX_FIFO)
+      UART_RWFIFO_REG(base) = UART_RWFIFO_RXWATER(uart->RxWatermark); // RDRF once the watermark is reached
+
+    FIFO_SetWakeLevel(&uart->RxFIFO, uart->RxWakeLevel); // The idle line interrupt wakes the reader for a partial batch
+    UART_C1_REG(base) |= UART_C1_ILT_MASK; // Idle character count starts after the stop bit
+    UART_C2_REG(base) |= UART_C2_RIE_MASK | UART_C2_ILIE_MASK; // Receive and idle line interrupts enabled
+  }
+  else
+    UART_C2_REG(base) |= UART_C2_RIE_MASK; // Receive(RDRF) interrupt enable
+
+  ExitCritical(); // End of critical section
+}
+
+
+void UART_SetWatermarks(const TUARTInstance instance, const uint8_t rxWatermark, const uint8_t txWatermark)
+{
+  TUARTState *uart = &UARTState[instance];    /*!< The UART */
+  UART_MemMapPtr base = uart->Hardware->base; /*!< Its registers */
+
+  EnterCritical(); // Start of critical section
+
+  uart->RxWatermark = rxWatermark; // Clamp to what the hardware FIFO can hold
+  if (uart->RxWatermark > uart->RxHWFIFODepth)
+    uart->RxWatermark = uart->RxHWFIFODepth;
+  if (uart->FlowControl && (uart->RxWatermark >= uart->RxHWFIFODepth) && (uart->RxHWFIFODepth > 1))
+    uart->RxWatermark = uart->RxHWFIFODepth - 1; // RTS is deasserted at the watermark, leave room for a character already on the way
+  if (uart->RxWatermark == 0)
+    uart->RxWatermark = 1;
+
+  if (uart->RxMode == UART_RX_FIFO)
+    UART_RWFIFO_REG(base) = UART_RWFIFO_RXWATER(uart->RxWatermark); // Takes effect immediately
+
+  if (txWatermark < uart->TxHWFIFODepth)
+    UART_TWFIFO_REG(base) = UART_TWFIFO_TXWATER(txWatermark); // TDRE is set while the transmit FIFO holds no more than this
+  else
+    UART_TWFIFO_REG(base) = UART_TWFIFO_TXWATER(uart->TxHWFIFODepth - 1);
+
+  ExitCritical(); // End of critical section
+}
+
+
+void UART_SetFlowControl(const TUARTInstance instance, const BOOL enable)
+{
+  TUARTState *uart = &UARTState[instance];    /*!< The UART */
+  UART_MemMapPtr base = uart->Hardware->base; /*!< Its registers */
+
+  if (uart->MultiDrop) // RTS is the transceiver enable
+    return;
+
+  EnterCritical(); // Start of critical section
+
+  uart->FlowControl = enable;
+
+  if (enable)
+  {
+    *uart->Hardware->rtsPCR = PORT_PCR_MUX(3); // RTS pin select
+    *uart->Hardware->ctsPCR = PORT_PCR_MUX(3); // CTS pin select
+    UART_MODEM_REG(base) |= UART_MODEM_RXRTSE_MASK | UART_MODEM_TXCTSE_MASK; // RTS follows the receive watermark, CTS gates the transmitter
+
+    if ((uart->RxWatermark >= uart->RxHWFIFODepth) && (uart->RxHWFIFODepth > 1))
+    {
+      uart->RxWatermark = uart->RxHWFIFODepth - 1; // Leave room for a character already on the way
+      if (uart->RxMode == UART_RX_FIFO)
+        UART_RWFIFO_REG(base) = UART_RWFIFO_RXWATER(uart->RxWatermark);
+    }
   }
+  else
+    UART_MODEM_REG(base) &= ~(UART_MODEM_RXRTSE_MASK | UART_MODEM_TXCTSE_MASK); // Pins stay routed but are ignored
+
+  ExitCritical(); // End of critical section
 }
 
 
-/*! @brief Thread that looks after transmitting data.
+BOOL UART_SetMultiDrop(const TUARTInstance instance, const BOOL enable, const uint8_t address)
+{
+  TUARTState *uart = &UARTState[instance];    /*!< The UART */
+  UART_MemMapPtr base = uart->Hardware->base; /*!< Its registers */
+  BOOL flowControl = uart->FlowControl;       /*!< Settings to restore if the transmitter does not drain */
+  BOOL multiDrop = uart->MultiDrop;
+
+  if (enable)
+  {
+    uart->FlowControl = bFALSE; // RTS and CTS are not available for flow control on a half duplex bus
+    uart->MultiDrop = bTRUE;
+    if (uart->RxMode == UART_RX_DMA)
+      UART_SetRxMode(instance, UART_RX_ISR); // Address characters have to be picked out one by one
+  }
+
+  if (!TxIdleEnterCritical(uart)) // Let everything queued go out in the old format
+  {
+    uart->FlowControl = flowControl; // The hardware is unchanged, UART_RX_ISR works in either format
+    uart->MultiDrop = multiDrop;
+    return bFALSE;
+  }
+
+  UART_C2_REG(base) &= ~(UART_C2_TE_MASK | UART_C2_RE_MASK); // Frame format may only change while idle
+
+  if (enable)
+  {
+    *uart->Hardware->rtsPCR = PORT_PCR_MUX(3); // RTS pin select
+    UART_MODEM_REG(base) = UART_MODEM_TXRTSE_MASK | UART_MODEM_TXRTSPOL_MASK; // RTS is high while a character is being sent, driving the transceiver enable
+    UART_C1_REG(base) |= UART_C1_M_MASK | UART_C1_WAKE_MASK; // 9-bit characters, the 9th bit marks an address
+    UART_MA1_REG(base) = address;
+    UART_C4_REG(base) |= UART_C4_MAEN1_MASK; // Hardware discards everything after an address that is not ours
+    UART_C3_REG(base) &= ~UART_C3_T8_MASK; // Everything we send is data for the master
+  }
+  else
+  {
+    uart->MultiDrop = bFALSE;
+    UART_MODEM_REG(base) = 0x00;
+    UART_C1_REG(base) &= ~(UART_C1_M_MASK | UART_C1_WAKE_MASK); // Back to 8-bit characters
+    UART_C4_REG(base) &= ~UART_C4_MAEN1_MASK;
+  }
+
+  UART_C2_REG(base) |= UART_C2_TE_MASK | UART_C2_RE_MASK;
+  TxDMAStart(uart); // Bulk data held back during the wait goes out in the new format
+
+  ExitCritical(); // End of critical section
+
+  return bTRUE;
+}
+
+
+void UART_SetRxWakeLevel(const TUARTInstance instance, const uint16_t wakeLevel)
+{
+  TUARTState *uart = &UARTState[instance]; /*!< The UART */
+
+  EnterCritical(); // Start of critical section
+
+  uart->RxWakeLevel = wakeLevel;
+  if ((uart->RxMode == UART_RX_FIFO) || (uart->RxMode == UART_RX_ISR))
+    FIFO_SetWakeLevel(&uart->RxFIFO, uart->RxWakeLevel); // Takes effect immediately
+
+  ExitCritical(); // End of critical section
+}
+
+
+/*! @brief Moves everything in the hardware receive FIFO into the RxFIFO.
  *
- *  @param pData Thread parameter.
+ *  @param uart The UART.
+ *  @note Must be called from the UART interrupt in UART_RX_FIFO or UART_RX_ISR mode, after S1 has been read.
+ *        Bytes that do not fit in the RxFIFO are discarded, unless flow control is on.
+ */
+static void RxHWFIFODrain(TUARTState* const uart)
+{
+  UART_MemMapPtr base = uart->Hardware->base; /*!< The UART registers */
+  uint8_t data[8];  /*!< Bytes read from the hardware FIFO in one pass */
+  uint8_t count;    /*!< Number of bytes in the hardware FIFO */
+  uint8_t put;      /*!< Number of bytes that fitted in the RxFIFO */
+  uint16_t space;   /*!< Free space in the RxFIFO */
+  uint8_t i, n;
+
+  count = UART_RCFIFO_REG(base);
+  if (count > sizeof(data))
+    count = sizeof(data);
+
+  if (count == 0) // Idle with nothing left, reading the data register to clear IDLE underflows the FIFO
+  {
+    (void)UART_D_REG(base);
+    UART_CFIFO_REG(base) |= UART_CFIFO_RXFLUSH_MASK; // Recover the FIFO pointers after the underflow
+    UART_SFIFO_REG(base) = UART_SFIFO_RXUF_MASK;
+    return;
+  }
+
+  if (uart->FlowControl) // Leave what does not fit in the hardware FIFO, whose watermark holds off the sender through RTS
+  {
+    space = FIFO_SIZE - FIFO_Count(&uart->RxFIFO);
+    if (count > space)
+      count = space;
+
+    if ((uint16_t)(space - count) < sizeof(data)) // Next batch may not fit, stop draining until UART_InChar makes room
+    {
+      UART_C2_REG(base) &= ~(UART_C2_RIE_MASK | UART_C2_ILIE_MASK);
+      uart->RxPaused = bTRUE;
+      FIFO_Wake(&uart->RxFIFO); // Let the reader empty the RxFIFO even below the wake level
+    }
+
+    if (count == 0)
+      return;
+  }
+
+  for (i = 0, n = 0; i < count; i++)
+  {
+    if (uart->MultiDrop && (UART_C3_REG(base) & UART_C3_R8_MASK)) // Our address, R8 belongs to the character about to be read
+      (void)UART_D_REG(base);
+    else
+      data[n++] = UART_D_REG(base); // The first read also clears RDRF and IDLE
+  }
+
+  if (n)
+    RxMark(uart, PIT_Timestamp());
+  put = FIFO_PutN(&uart->RxFIFO, data, n); // One publish for the whole batch
+  uart->Stats.rxBytes += put;
+  uart->Stats.rxDropped += n - put;
+}
+
+
+/*! @brief Hands the bytes received so far to the receive thread and switches the DMA channel to the other buffer.
+ *
+ *  @param uart The UART.
+ *  If the receive thread has not yet emptied the other buffer, a partly filled buffer keeps filling
+ *  and a full one leaves the channel stopped, so the hardware FIFO fills and RTS holds off the sender.
+ *  While stopped the idle line interrupt is off too, as IDLE cannot be cleared with bytes left in the hardware FIFO.
+ *  The receive thread calls it again once it has emptied the other buffer, which turns both back on.
+ *  @note Must be called with interrupts disabled or from the UART or receive DMA interrupts.
+ */
+static void RxDMASwap(TUARTState* const uart)
+{
+  UART_MemMapPtr base = uart->Hardware->base;     /*!< The UART registers */
+  uint8_t channel = uart->Hardware->rxDMAChannel; /*!< The receive DMA channel */
+  uint16_t count; /*!< Number of bytes received into the current buffer */
+
+  DMA_CERQ = DMA_CERQ_CERQ(channel); // Hold off requests while the buffers are swapped
+
+  if (DMA_CSR_REG(DMA_BASE_PTR, channel) & DMA_CSR_DONE_MASK) // Buffer is full, CITER has already been reloaded
+    count = RX_DMA_BUFFER_SIZE;
+  else
+    count = RX_DMA_BUFFER_SIZE - (DMA_CITER_ELINKNO_REG(DMA_BASE_PTR, channel) & DMA_CITER_ELINKNO_CITER_MASK);
+
+  if (uart->RxDMASpan[uart->RxDMAIndex ^ 1]) // Other buffer still in use
+  {
+    if (count < RX_DMA_BUFFER_SIZE)
+      DMA_SERQ = DMA_SERQ_SERQ(channel); // Room left, keep filling the current buffer
+    else
+      UART_C2_REG(base) &= ~UART_C2_ILIE_MASK; // Stalled, an idle line with bytes left in the hardware FIFO would interrupt forever
+    return;
+  }
+
+  if (count)
+  {
+    uart->RxDMASpan[uart->RxDMAIndex] = count; // Completed span is ready for the receive thread
+    uart->RxDMATime[uart->RxDMAIndex] = PIT_Timestamp(); // Its last byte arrived at most an idle character or a DMA request ago
+    uart->RxDMAIndex ^= 1; // Switch to the other buffer
+
+    DMA_CDNE = DMA_CDNE_CDNE(channel);
+    DMA_DADDR_REG(DMA_BASE_PTR, channel) = (uint32_t)uart->RxDMABuffer[uart->RxDMAIndex];
+    DMA_CITER_ELINKNO_REG(DMA_BASE_PTR, channel) = DMA_CITER_ELINKNO_CITER(RX_DMA_BUFFER_SIZE);
+
+    OS_SemaphoreSignal(uart->ReceiveSemaphore); // Signal receive thread
+  }
+
+  DMA_SERQ = DMA_SERQ_SERQ(channel); // Resume receiving
+  UART_C2_REG(base) |= UART_C2_ILIE_MASK; // Back on after a stall
+}
+
+
+/*! @brief Thread that looks after receiving data for one UART.
+ *
+ *  In UART_RX_INT mode it moves the single byte in the data register into the RxFIFO.
+ *  In UART_RX_DMA mode it moves every completed buffer span into the RxFIFO.
+ *  @param pData The TUARTState of the UART.
  *  @note Assumes that semaphores are created and communicate properly.
  */
-void TransmitThread(void *data)
+static void ReceiveThread(void* pData)
 {
+  TUARTState *uart = (TUARTState *)pData; /*!< The UART served by this thread */
+  uint8_t readIndex;     /*!< The next DMA buffer to be emptied */
+  uint16_t count;        /*!< Number of bytes of the span moved so far */
+  uint16_t span;         /*!< Number of bytes in the span */
+  uint8_t data;          /*!< The byte received in UART_RX_INT mode */
+  BOOL received;         /*!< TRUE if the byte is data for the RxFIFO */
+
   for (;;)
   {
-    OS_SemaphoreWait(TransmitSemaphore, 0); // Wait for transmit semaphore to signal
-    if (UART2_S1 & UART_S1_TDRE_MASK) // Clear TDRE flag by reading it
+    OS_SemaphoreWait(uart->ReceiveSemaphore, 0); // Wait for receive semaphore to signal
+
+    if (uart->RxMode == UART_RX_DMA)
     {
-      FIFO_Get(&TxFIFO,(uint8_t* )&UART2_D);
-      UART2_C2 |= UART_C2_TIE_MASK; // Re-enable transmission interrupt
+      while ((span = uart->RxDMASpan[readIndex = uart->RxDMAReadIndex])) // Empty completed spans in the order they were filled
+      {
+        EnterCritical(); // Marks are shared with the reader
+        RxMark(uart, uart->RxDMATime[readIndex]); // Time of the hand over, not of the move
+        ExitCritical();
+
+        count = 0;
+        while (count < span)
+        {
+          count += FIFO_PutN(&uart->RxFIFO, &uart->RxDMABuffer[readIndex][count], span - count); // Move as much of the span as fits
+          if (count < span)
+            FIFO_Put(&uart->RxFIFO, uart->RxDMABuffer[readIndex][count++]); // RxFIFO is full, wait for space
+        }
+
+        EnterCritical(); // Counters are shared with the interrupts
+        uart->Stats.rxBytes += span;
+        ExitCritical();
+
+        EnterCritical(); // Start of critical section
+        uart->RxDMASpan[readIndex] = 0; // Buffer is free again
+        uart->RxDMAReadIndex = readIndex ^ 1;
+        RxDMASwap(uart); // Restart a stalled channel or hand over a buffer held back meanwhile
+        ExitCritical(); // End of critical section
+      }
+    }
+    else
+    {
+      received = bFALSE;
+      EnterCritical(); // RxErrorRecover may flush the byte, it must not go between the check and the read
+      if (UART_S1_REG(uart->Hardware->base) & UART_S1_RDRF_MASK) // Still there, reading an empty FIFO would underflow it
+      {
+        if (uart->MultiDrop && (UART_C3_REG(uart->Hardware->base) & UART_C3_R8_MASK)) // Our address, not part of the data
+          (void)UART_D_REG(uart->Hardware->base);
+        else
+        {
+          data = UART_D_REG(uart->Hardware->base);
+          RxMark(uart, uart->RxIntTime); // Time of the receive interrupt, not of the move
+          received = bTRUE;
+        }
+      }
+      ExitCritical();
+
+      if (received)
+      {
+        FIFO_Put(&uart->RxFIFO, data); // Put byte into RxFIFO, may wait for space
+
+        EnterCritical(); // Counters are shared with the interrupts
+        uart->Stats.rxBytes++;
+        ExitCritical();
+      }
+
+      UART_C2_REG(uart->Hardware->base) |= UART_C2_RIE_MASK; // Re-enable receive interrupt
     }
   }
 }
 
 
+/*! @brief Finds the UART whose RX_TX or ERR interrupt is being serviced.
+ *
+ *  @return TUARTState* - The UART, or NULL if the interrupt does not belong to an initialized UART.
+ */
+static TUARTState* ActiveUART(void)
+{
+  uint16_t irq = (SCB_ICSR & SCB_ICSR_VECTACTIVE_MASK) - VECTOR_IRQ_BASE; /*!< Interrupt number of the active vector */
+  uint8_t i;
+
+  for (i = 0; i < UART_NB_INSTANCES; i++)
+    if (UARTState[i].Initialized && ((irq == UARTHardware[i].irq) || (irq == UARTHardware[i].irq + 1)))
+      return &UARTState[i];
+
+  return NULL;
+}
+
+
+/*! @brief Finds the UART whose DMA channel interrupt is being serviced.
+ *
+ *  @param transmit TRUE to match the transmit channels, FALSE to match the receive channels.
+ *  @return TUARTState* - The UART, or NULL if the channel does not belong to an initialized UART.
+ */
+static TUARTState* ActiveDMAUART(const BOOL transmit)
+{
+  uint16_t channel = (SCB_ICSR & SCB_ICSR_VECTACTIVE_MASK) - VECTOR_IRQ_BASE; /*!< DMA channels 0-15 are interrupts 0-15 */
+  uint8_t i;
+
+  for (i = 0; i < UART_NB_INSTANCES; i++)
+    if (UARTState[i].Initialized &&
+        ((transmit ? UARTHardware[i].txDMAChannel : UARTHardware[i].rxDMAChannel) == channel))
+      return &UARTState[i];
+
+  return NULL;
+}
+
+
 void __attribute__ ((interrupt)) UART_ISR(void)
 {
+  TUARTState *uart;      /*!< The UART that raised the interrupt */
+  UART_MemMapPtr base;   /*!< Its registers */
+  uint8_t status;        /*!< Copy of S1 */
+
+  OS_ISREnter(); // Start of servicing interrupt
+
+  uart = ActiveUART();
+  if (!uart)
+  {
+    OS_ISRExit();
+    return;
+  }
+
+  base = uart->Hardware->base;
+
+  if (uart->RxMode == UART_RX_DMA)
+  {
+    // Line has gone idle after a burst. Bytes still in the hardware FIFO belong to the DMA, IDLE stays set until it has them
+    if ((UART_S1_REG(base) & UART_S1_IDLE_MASK) && (UART_RCFIFO_REG(base) == 0))
+    {
+      (void)UART_D_REG(base); // Clear IDLE flag by reading the data register, which underflows the empty FIFO
+      UART_CFIFO_REG(base) |= UART_CFIFO_RXFLUSH_MASK; // Recover the FIFO pointers after the underflow
+      UART_SFIFO_REG(base) = UART_SFIFO_RXUF_MASK;
+      RxDMASwap(uart); // Hand over the partly filled buffer
+    }
+  }
+  else if ((uart->RxMode == UART_RX_FIFO) || (uart->RxMode == UART_RX_ISR))
+  {
+    status = UART_S1_REG(base); // First step of clearing RDRF and IDLE
+
+    if (status & (UART_S1_RDRF_MASK | UART_S1_IDLE_MASK)) // Data ready or line gone idle with trailing bytes
+      RxHWFIFODrain(uart);
+
+    if (status & UART_S1_IDLE_MASK) // No more data coming soon, wake the reader for a partial batch
+      FIFO_Wake(&uart->RxFIFO);
+  }
+  else if (UART_S1_REG(base) & UART_S1_RDRF_MASK) // Clear RDRF flag by reading it
+  {
+    uart->RxIntTime = PIT_Timestamp(); // The receive thread may only get to the byte later
+    UART_C2_REG(base) &= ~UART_C2_RIE_MASK; // Receive interrupt disabled
+    OS_SemaphoreSignal(uart->ReceiveSemaphore); // Signal receive thread
+  }
+
+  OS_ISRExit(); // End of servicing interrupt
+}
+
+
+/*! @brief Counts and clears the line errors flagged in a copy of S1.
+ *
+ *  The byte with a noise, framing or parity error is read and discarded, which also clears the flags.
+ *  An overrun has already lost data so the rest of the hardware FIFO is flushed rather than passing on a torn frame.
+ *  In UART_RX_INT mode the receive thread may be about to read the byte, so the hardware FIFO is always flushed
+ *  and the thread finds RDRF clear.
+ *  @param uart The UART.
+ *  @param status S1, read as the first step of clearing the flags.
+ *  @note Must be called from the UART interrupts.
+ */
+static void RxErrorRecover(TUARTState* const uart, const uint8_t status)
+{
+  UART_MemMapPtr base = uart->Hardware->base; /*!< The UART registers */
+
+  if (status & UART_S1_OR_MASK)
+    uart->Stats.overruns++;
+  if (status & UART_S1_NF_MASK)
+    uart->Stats.noiseErrors++;
+  if (status & UART_S1_FE_MASK)
+    uart->Stats.framingErrors++;
+  if (status & UART_S1_PF_MASK)
+    uart->Stats.parityErrors++;
+  uart->LineErrors++;
+
+  if ((UART_RCFIFO_REG(base) == 0) || (uart->RxMode == UART_RX_INT)) // Empty, or the receive thread owns the data register
+  {
+    (void)UART_D_REG(base); // Second step of clearing the flags, may underflow the FIFO
+    UART_CFIFO_REG(base) |= UART_CFIFO_RXFLUSH_MASK;
+    UART_SFIFO_REG(base) = UART_SFIFO_RXUF_MASK;
+    return;
+  }
+
+  (void)UART_D_REG(base); // Discard the bad byte, second step of clearing the flags
+
+  if (status & UART_S1_OR_MASK)
+    UART_CFIFO_REG(base) |= UART_CFIFO_RXFLUSH_MASK; // Whatever is left belongs to a frame that lost bytes
+}
+
+
+void __attribute__ ((interrupt)) UART_ErrorISR(void)
+{
+  TUARTState *uart; /*!< The UART that raised the interrupt */
+  uint8_t status;   /*!< Copy of S1 */
+
   OS_ISREnter(); // Start of servicing interrupt
 
-  if (UART2_S1 & UART_S1_RDRF_MASK) // Clear RDRF flag by reading it
+  uart = ActiveUART();
+  if (uart)
   {
-    UART2_C2 &= ~UART_C2_RIE_MASK; // Receive interrupt disabled
-    OS_SemaphoreSignal(ReceiveSemaphore); // Signal receive thread
+    status = UART_S1_REG(uart->Hardware->base); // First step of clearing the error flags
+    if (status & (UART_S1_OR_MASK | UART_S1_NF_MASK | UART_S1_FE_MASK | UART_S1_PF_MASK))
+      RxErrorRecover(uart, status);
   }
 
-  if (UART2_C2 & UART_C2_TIE_MASK) // Clear TDRE flag by reading it
+  OS_ISRExit(); // End of servicing interrupt
+}
+
+
+void __attribute__ ((interrupt)) UART_TxDMA_ISR(void)
+{
+  TUARTState *uart; /*!< The UART that owns the channel */
+
+  OS_ISREnter(); // Start of servicing interrupt
+
+  uart = ActiveDMAUART(bTRUE);
+  if (uart)
+  {
+    DMA_CINT = DMA_CINT_CINT(uart->Hardware->txDMAChannel); // Clear the major loop interrupt request
+
+    uart->Stats.txBytes += uart->TxDMACount;
+
+    if (uart->TxBlockCount) // Part of a block sent in place
+    {
+      uart->TxBlock += uart->TxDMACount;
+      uart->TxBlockCount -= uart->TxDMACount;
+      if (uart->TxBlockCount == 0)
+        OS_SemaphoreSignal(uart->TxBlockSemaphore);
+    }
+    else
+    {
+      FIFO_CommitRead(&uart->TxLane[uart->TxActiveLane].FIFO, uart->TxDMACount); // Release the transmitted block from the lane
+      uart->TxLane[uart->TxActiveLane].Sent += uart->TxDMACount;
+    }
+    uart->TxDMACount = 0;
+
+    if (uart->TxBlockCount)
+      TxBlockStart(uart); // Rest of the block goes before anything queued since
+    else
+    {
+      TxDMAStart(uart); // Chain the next block
+      if (!uart->TxDMACount)
+        UART_C2_REG(uart->Hardware->base) &= ~UART_C2_TIE_MASK; // Nothing left to send
+    }
+  }
+
+  OS_ISRExit(); // End of servicing interrupt
+}
+
+
+void __attribute__ ((interrupt)) UART_RxDMA_ISR(void)
+{
+  TUARTState *uart; /*!< The UART that owns the channel */
+
+  OS_ISREnter(); // Start of servicing interrupt
+
+  uart = ActiveDMAUART(bFALSE);
+  if (uart)
   {
-    UART2_C2 &= ~UART_C2_TIE_MASK; // Transmit interrupt disabled
-    OS_SemaphoreSignal(TransmitSemaphore); // Signal transmit thread
+    DMA_CINT = DMA_CINT_CINT(uart->Hardware->rxDMAChannel); // Clear the major loop interrupt request
+    RxDMASwap(uart); // Buffer is full, hand it over
   }
 
   OS_ISRExit(); // End of servicing interrupt
@@ -14,29 +14,233 @@
 // new types
 #include "types.h"
 
-/*! @brief Sets up the UART interface before first use.
+typedef enum
+{
+  UART_INSTANCE_0,
+  UART_INSTANCE_1,
+  UART_INSTANCE_2,
+  UART_INSTANCE_3,
+  UART_INSTANCE_4,
+  UART_INSTANCE_5,
+  UART_NB_INSTANCES
+} TUARTInstance;
+
+typedef enum
+{
+  UART_RX_INT,  /*!< One receive interrupt per byte, moved into the receive FIFO by the receive thread. */
+  UART_RX_DMA,  /*!< DMA fills ping-pong buffers which are handed over on an idle line or a full buffer. */
+  UART_RX_FIFO, /*!< The hardware FIFO is emptied by the interrupt once the watermark is reached or the line goes idle. */
+  UART_RX_ISR   /*!< Every byte is moved into the receive FIFO by the interrupt, skipping the receive thread. */
+} TUARTRxMode;
+
+typedef enum
+{
+  UART_LANE_CONTROL, /*!< Replies and acknowledgements, always sent first. */
+  UART_LANE_BULK,    /*!< Streams and bulk transfers, sent when the control lane is empty. */
+  UART_NB_LANES
+} TUARTLane;
+
+typedef struct
+{
+  uint32_t rxBytes;   /*!< Bytes placed in the receive FIFO. */
+  uint32_t txBytes;   /*!< Bytes handed to the transmitter. */
+  uint32_t rxDropped; /*!< Received bytes discarded because the receive FIFO was full. */
+  uint32_t overruns;      /*!< Receiver overruns, the bytes in the hardware FIFO are discarded. */
+  uint32_t noiseErrors;   /*!< Bytes received with noise, discarded. */
+  uint32_t framingErrors; /*!< Bytes received with a missing stop bit, discarded. */
+  uint32_t parityErrors;  /*!< Bytes received with a parity error, discarded. */
+} TUARTStats;
+
+/*! @brief Sets up a UART before first use.
  *
+ *  Each UART has its own transmit and receive FIFOs, DMA channels and receive thread.
+ *  @param instance The UART to set up.
  *  @param baudRate The desired baud rate in bits/sec.
- *  @param moduleClk The module clock rate in Hz.
+ *  @param moduleClk The module clock rate in Hz, the bus clock for UART2-5 and the core clock for UART0 and UART1.
+ *  @param threadPriority The priority of the UART's receive thread.
  *  @return BOOL - TRUE if the UART was successfully initialized.
  */
-BOOL UART_Init(const uint32_t baudRate, const uint32_t moduleClk);
+BOOL UART_Init(const TUARTInstance instance, const uint32_t baudRate, const uint32_t moduleClk, const uint8_t threadPriority);
  
+/*! @brief Checks whether a baud rate can be generated from the module clock.
+ *
+ *  @param instance The UART.
+ *  @param baudRate The desired baud rate in bits/sec.
+ *  @return BOOL - TRUE if the achievable rate is within 2% of the desired rate.
+ *  @note Assumes that UART_Init has been called.
+ */
+BOOL UART_CheckBaudRate(const TUARTInstance instance, const uint32_t baudRate);
+
+/*! @brief Changes the baud rate.
+ *
+ *  Waits for everything already in the transmit FIFO to be sent at the old rate before switching.
+ *  The bulk lane is held at its next frame end during the wait and resumes at the new rate.
+ *  @param instance The UART.
+ *  @param baudRate The desired baud rate in bits/sec.
+ *  @return BOOL - TRUE if the baud rate was changed, FALSE if it cannot be generated within 2% or the transmitter did not drain in time.
+ *  @note Assumes that UART_Init has been called. Must not be called from an ISR.
+ */
+BOOL UART_SetBaudRate(const TUARTInstance instance, const uint32_t baudRate);
+
 /*! @brief Get a character from the receive FIFO if it is not empty.
  *
+ *  @param instance The UART.
  *  @param dataPtr A pointer to memory to store the retrieved byte.
  *  @return BOOL - TRUE if the receive FIFO returned a character.
  *  @note Assumes that UART_Init has been called.
  */
-BOOL UART_InChar(uint8_t* const dataPtr);
+BOOL UART_InChar(const TUARTInstance instance, uint8_t* const dataPtr);
  
-/*! @brief Put a byte in the transmit FIFO if it is not full.
+/*! @brief Gets the characters already in the receive FIFO, without waiting.
  *
+ *  @param instance The UART.
+ *  @param data A pointer to memory to store the retrieved bytes.
+ *  @param nbBytes The maximum number of bytes to retrieve.
+ *  @return uint16_t - The number of bytes retrieved, 0 if the receive FIFO is empty.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint16_t UART_InChars(const TUARTInstance instance, uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Gets the arrival time of the last byte read by UART_InChar or UART_InChars.
+ *
+ *  Bytes are stamped when the UART interrupt, or the DMA hand over, receives them, so the time does not depend on how late
+ *  the reader gets to them. Bytes that arrived together share a time stamp.
+ *  @param instance The UART.
+ *  @return uint32_t - The PIT_Timestamp value at the arrival of the byte.
+ *  @note Assumes that UART_Init and PIT_Init have been called.
+ */
+uint32_t UART_RxTimestamp(const TUARTInstance instance);
+
+/*! @brief Waits until the receive FIFO holds data.
+ *
+ *  In UART_RX_FIFO and UART_RX_ISR modes the reader is woken at the wake level or when the line goes idle.
+ *  @param instance The UART.
+ *  @note Assumes that UART_Init has been called. Must not be called from an ISR.
+ */
+void UART_WaitForData(const TUARTInstance instance);
+
+/*! @brief Put a byte in the control lane transmit FIFO if it is not full.
+ *
+ *  Waits for space if the transmit FIFO is full. The byte is a frame of its own.
+ *  @param instance The UART.
  *  @param data The byte to be placed in the transmit FIFO.
  *  @return BOOL - TRUE if the data was placed in the transmit FIFO.
+ *  @note Assumes that UART_Init has been called. Only one thread at a time may write to a UART. Must not be called from an ISR.
+ */
+BOOL UART_OutChar(const TUARTInstance instance, const uint8_t data);
+
+/*! @brief Puts a block of bytes in the control lane transmit FIFO as one frame, waiting for space as needed.
+ *
+ *  @param instance The UART.
+ *  @param data A pointer to the bytes to send.
+ *  @param nbBytes The number of bytes.
+ *  @note Assumes that UART_Init has been called. Only one thread at a time may write to a UART. Must not be called from an ISR.
+ */
+void UART_OutChars(const TUARTInstance instance, const uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Puts bytes in the transmit FIFO of a lane, waiting for space as needed.
+ *
+ *  The transmitter only changes lane between frames, so the bytes of a frame are never interleaved with another lane.
+ *  Between frames the control lane goes first.
+ *  @param instance The UART.
+ *  @param lane The lane.
+ *  @param data A pointer to the bytes to send.
+ *  @param nbBytes The number of bytes.
+ *  @param endOfFrame TRUE if these are the last bytes of a frame.
+ *  @note Assumes that UART_Init has been called. Only one thread at a time may write to a lane, and a frame must be ended
+ *        promptly as the other lane waits for it. Must not be called from an ISR.
+ */
+void UART_OutLane(const TUARTInstance instance, const TUARTLane lane, const uint8_t* const data, const uint16_t nbBytes, const BOOL endOfFrame);
+
+/*! @brief Sends a block of memory in place on the bulk lane, without copying it through the transmit FIFO.
+ *
+ *  Waits for the bytes already queued on the bulk lane to go out, then the transmit DMA channel reads the block directly.
+ *  The block continues the current bulk lane frame, which UART_OutLane has to end afterwards; the control lane waits for it.
+ *  @param instance The UART.
+ *  @param data A pointer to the block, in memory the DMA can read such as flash or SRAM.
+ *  @param nbBytes The number of bytes.
+ *  @note Assumes that UART_Init has been called. Only one thread at a time may write to the bulk lane. Must not be called from an ISR.
+ *        Returns once the last byte has been handed to the UART.
+ */
+void UART_OutBlock(const TUARTInstance instance, const uint8_t* const data, const uint32_t nbBytes);
+
+/*! @brief Selects how received bytes are moved into the receive FIFO.
+ *
+ *  @param instance The UART.
+ *  @param rxMode specifies thread, DMA, hardware FIFO or interrupt driven reception.
+ *  @note Assumes that UART_Init has been called. UART_Init selects UART_RX_INT.
+ */
+void UART_SetRxMode(const TUARTInstance instance, const TUARTRxMode rxMode);
+
+/*! @brief Sets the hardware FIFO watermarks.
+ *
+ *  @param instance The UART.
+ *  @param rxWatermark The number of received bytes that raises an interrupt in UART_RX_FIFO mode.
+ *  @param txWatermark The transmit FIFO level at or below which more data is requested.
+ *  @note Assumes that UART_Init has been called. Values are clamped to the depth of the hardware FIFOs.
+ */
+void UART_SetWatermarks(const TUARTInstance instance, const uint8_t rxWatermark, const uint8_t txWatermark);
+
+/*! @brief Turns hardware RTS/CTS flow control on or off.
+ *
+ *  RTS is deasserted while the hardware receive FIFO is at its watermark.
+ *  When the receive FIFO is nearly full the UART stops emptying the hardware FIFO, so RTS holds off the sender instead of bytes being lost.
+ *  The transmitter only starts a character while CTS is asserted.
+ *  @param instance The UART.
+ *  @param enable TRUE to route the RTS and CTS pins and use them.
+ *  @note Assumes that UART_Init has been called. Flow control is off after UART_Init and ignored in multi-drop mode.
+ */
+void UART_SetFlowControl(const TUARTInstance instance, const BOOL enable);
+
+/*! @brief Turns RS-485 multi-drop operation on or off.
+ *
+ *  Characters are 9 bits long and the master marks an address character by setting the 9th bit.
+ *  The receiver discards, in hardware, everything following an address other than this node's, so other nodes' traffic never raises an interrupt.
+ *  The matching address character itself is discarded by the driver and data is passed on as usual.
+ *  RTS drives the transceiver enable, high while a character is being sent.
+ *  DMA reception and flow control are unavailable while multi-drop is on, UART_RX_DMA falls back to UART_RX_ISR.
+ *  @param instance The UART.
+ *  @param enable TRUE to join a multi-drop bus.
+ *  @param address This node's address.
+ *  @return BOOL - TRUE if the format was changed, FALSE if the transmitter did not drain in time.
+ *  @note Assumes that UART_Init has been called. Waits for the transmit FIFO to empty, so must not be called from an ISR.
+ */
+BOOL UART_SetMultiDrop(const TUARTInstance instance, const BOOL enable, const uint8_t address);
+
+/*! @brief Sets how many received bytes wake a reader blocked in UART_InChar.
+ *
+ *  Only used in UART_RX_FIFO and UART_RX_ISR modes, where the idle line wakes the reader for any trailing bytes.
+ *  @param instance The UART.
+ *  @param wakeLevel The number of bytes, e.g. one packet.
  *  @note Assumes that UART_Init has been called.
  */
-BOOL UART_OutChar(const uint8_t data);
+void UART_SetRxWakeLevel(const TUARTInstance instance, const uint16_t wakeLevel);
+
+/*! @brief Gets a snapshot of the traffic counters.
+ *
+ *  @param instance The UART.
+ *  @param stats A pointer to memory to store the counters.
+ *  @note Assumes that UART_Init has been called.
+ */
+void UART_GetStats(const TUARTInstance instance, TUARTStats* const stats);
+
+/*! @brief Gets the number of bytes waiting in the transmit FIFO of a lane, a measure of how far its writer is ahead of the line.
+ *
+ *  @param instance The UART.
+ *  @param lane The lane.
+ *  @return uint16_t - The number of bytes, at most FIFO_SIZE.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint16_t UART_TxPending(const TUARTInstance instance, const TUARTLane lane);
+
+/*! @brief Gets the total number of line errors of any type.
+ *
+ *  Cheaper than UART_GetStats for a reader that only needs to notice that bytes were lost, e.g. to drop a partial frame.
+ *  @param instance The UART.
+ *  @return uint32_t - The number of line errors since UART_Init.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint32_t UART_LineErrors(const TUARTInstance instance);
 
 /*! @brief Poll the UART status register to try and receive and/or transmit one character.
  *
@@ -45,10 +249,34 @@ BOOL UART_OutChar(const uint8_t data);
  */
 void UART_Poll(void);
 
-/*! @brief Interrupt service routine for the UART.
+/*! @brief Interrupt service routine shared by the UARTs.
  *
+ *  The active vector identifies which UART raised the interrupt.
  *  @note Assumes the transmit and receive FIFOs have been initialized.
  */
 void __attribute__ ((interrupt)) UART_ISR(void);
 
+/*! @brief Interrupt service routine shared by the UART error interrupts.
+ *
+ *  Counts and clears overrun, noise, framing and parity errors, discarding the affected data.
+ *  @note Assumes that UART_Init has been called.
+ */
+void __attribute__ ((interrupt)) UART_ErrorISR(void);
+
+/*! @brief Interrupt service routine shared by the transmit DMA channels.
+ *
+ *  A block of a transmit FIFO, or part of a block given to UART_OutBlock, has been sent.
+ *  The block is released from the FIFO and the next part or block, from the lane chosen at a frame boundary, is started.
+ *  @note Assumes that UART_Init has been called.
+ */
+void __attribute__ ((interrupt)) UART_TxDMA_ISR(void);
+
+/*! @brief Interrupt service routine shared by the receive DMA channels.
+ *
+ *  A receive buffer is full.
+ *  The buffer is handed to the receive thread and reception continues into the other buffer.
+ *  @note Assumes that UART_SetRxMode has selected UART_RX_DMA.
+ */
+void __attribute__ ((interrupt)) UART_RxDMA_ISR(void);
+
 #endif
@@ -23,8 +23,17 @@
 #include "PE_types.h"
 
 // Accelerometer registers
+#define ADDRESS_F_STATUS 0x00
+
+#define F_STATUS_F_CNT_MASK 0x3F
+
 #define ADDRESS_OUT_X_MSB 0x01
 
+#define ADDRESS_F_SETUP 0x09
+
+#define F_SETUP_F_MODE_CIRCULAR 0x40
+#define F_SETUP_F_WMRK_MASK 0x3F
+
 #define ADDRESS_INT_SOURCE 0x0C
 
 static union
@@ -54,18 +63,6 @@ static union
 
 #define ADDRESS_CTRL_REG1 0x2A
 
-typedef enum
-{
-  DATE_RATE_800_HZ,
-  DATE_RATE_400_HZ,
-  DATE_RATE_200_HZ,
-  DATE_RATE_100_HZ,
-  DATE_RATE_50_HZ,
-  DATE_RATE_12_5_HZ,
-  DATE_RATE_6_25_HZ,
-  DATE_RATE_1_56_HZ
-} TOutputDataRate;
-
 typedef enum
 {
   SLEEP_MODE_RATE_50_HZ,
@@ -257,12 +254,14 @@ static void PushArray(uint8_t data[3])
 
 void Accel_SetMode(const TAccelMode mode)
 {
-  CTRL_REG4_INT_EN_DRDY = mode; // Interrupt or polling
+  CTRL_REG4_INT_EN_DRDY = (mode == ACCEL_INT); // Interrupt or polling
+  CTRL_REG4_INT_EN_FIFO = 0; // FIFO is only used by Accel_SetStream
   CTRL_REG1_F_READ = 1; // 8-bit select
   CTRL_REG1_ACTIVE = 0; // Deactivate accelerometer
   CTRL_REG1_DR = DATE_RATE_1_56_HZ; // 1.56Hz data rate select
 
   I2C_Write(ADDRESS_CTRL_REG1,CTRL_REG1); // Deactivate accelerometer
+  I2C_Write(ADDRESS_F_SETUP,0); // FIFO off, may only be changed in standby
 
   EnterCritical(); // Start of critical section
 
@@ -280,6 +279,47 @@ void Accel_SetMode(const TAccelMode mode)
 }
 
 
+void Accel_SetStream(const TOutputDataRate rate, const uint8_t watermark)
+{
+  CTRL_REG4_INT_EN_DRDY = 0; // One interrupt per watermark instead of per sample
+  CTRL_REG4_INT_EN_FIFO = 1;
+  CTRL_REG1_F_READ = 1; // 8-bit select, a burst read from OUT_X_MSB then returns whole FIFO samples
+  CTRL_REG1_ACTIVE = 0; // Deactivate accelerometer
+  CTRL_REG1_DR = rate;
+
+  I2C_Write(ADDRESS_CTRL_REG1,CTRL_REG1); // Deactivate accelerometer
+  I2C_Write(ADDRESS_F_SETUP,0); // F_MODE has to pass through off to change
+  I2C_Write(ADDRESS_F_SETUP,F_SETUP_F_MODE_CIRCULAR | (watermark & F_SETUP_F_WMRK_MASK));
+
+  EnterCritical(); // Start of critical section
+
+  I2C_Write(ADDRESS_CTRL_REG4,CTRL_REG4); // FIFO watermark interrupt enable
+
+  CTRL_REG1_ACTIVE = 1; // Activate accelerometer
+  I2C_Write(ADDRESS_CTRL_REG1,CTRL_REG1); // 8-bits data select, rate select, and activate
+
+  PORTB_PCR7 |= PORT_PCR_IRQC(0x0A); // GPIOB with falling edge interrupt
+
+  ExitCritical(); // End of critical section
+}
+
+
+uint8_t Accel_FIFOCount(void)
+{
+  uint8_t status; /*!< F_STATUS register */
+
+  I2C_PollRead(ADDRESS_F_STATUS, &status, 1); // Reading F_STATUS releases the watermark interrupt
+  return status & F_STATUS_F_CNT_MASK;
+}
+
+
+void Accel_ReadSamples(uint8_t* const data, const uint8_t count)
+{
+  if (count)
+    I2C_IntRead(ADDRESS_OUT_X_MSB, data, count * 3); // Address wraps from OUT_Z_MSB back to OUT_X_MSB, the next FIFO sample
+}
+
+
 void __attribute__ ((interrupt)) AccelDataReady_ISR(void)
 {
   OS_ISREnter(); // Start of servicing interrupt
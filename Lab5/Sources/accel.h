@@ -17,9 +17,25 @@
 typedef enum
 {
   ACCEL_POLL,
-  ACCEL_INT
+  ACCEL_INT,
+  ACCEL_STREAM
 } TAccelMode;
 
+typedef enum
+{
+  DATE_RATE_800_HZ,
+  DATE_RATE_400_HZ,
+  DATE_RATE_200_HZ,
+  DATE_RATE_100_HZ,
+  DATE_RATE_50_HZ,
+  DATE_RATE_12_5_HZ,
+  DATE_RATE_6_25_HZ,
+  DATE_RATE_1_56_HZ
+} TOutputDataRate;
+
+// Depth of the accelerometer FIFO in XYZ samples
+#define ACCEL_FIFO_DEPTH 32
+
 
 #pragma pack(push)
 #pragma pack(1)
@@ -53,6 +69,29 @@ void Accel_ReadXYZ(uint8_t data[3]);
  */
 void Accel_SetMode(const TAccelMode mode);
 
+/*! @brief Sets the accelerometer to collect samples in its FIFO at a given rate, for ACCEL_STREAM.
+ *
+ *  The data ready interrupt is raised whenever the FIFO holds at least watermark samples.
+ *  @param rate The output data rate.
+ *  @param watermark The number of samples that raises the interrupt, from 1 to ACCEL_FIFO_DEPTH.
+ */
+void Accel_SetStream(const TOutputDataRate rate, const uint8_t watermark);
+
+/*! @brief Gets the number of samples waiting in the accelerometer FIFO, which also clears the FIFO interrupt.
+ *
+ *  @return uint8_t - The number of samples, at most ACCEL_FIFO_DEPTH.
+ *  @note Assumes that Accel_SetStream has been called.
+ */
+uint8_t Accel_FIFOCount(void);
+
+/*! @brief Starts reading samples from the accelerometer FIFO with the I2C interrupt method.
+ *
+ *  Read_Complete_Semaphore is signaled once the samples are in data. The samples are not median filtered.
+ *  @param data An array of 3 bytes per sample where the X, Y and Z data are stored, oldest sample first.
+ *  @param count The number of samples, as returned by Accel_FIFOCount.
+ */
+void Accel_ReadSamples(uint8_t* const data, const uint8_t count);
+
 /*! @brief Interrupt service routine for the accelerometer.
  *
  *  The accelerometer has data ready.
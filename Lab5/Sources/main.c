@@ -33,6 +33,8 @@
 #include "RTC.h"
 #include "FTM.h"
 #include "accel.h"
+#include "Cmd.h"
+#include "Delta.h"
 
 // Arbitrary thread stack size - big enough for stacking of interrupts and OS use.
 #define THREAD_STACK_SIZE 100
@@ -40,6 +42,21 @@
 // Baud rate defined
 #define BAUD_RATE 115200
 
+// bTRUE to share the link with other towers on an RS-485 bus, addressed by tower number
+// Towers on a shared bus only transmit in reply to the master, so the periodic packets are not sent
+#define RS485_MULTI_DROP bFALSE
+
+// Number of PIT periods (seconds) the PC has to confirm a new baud rate before the tower falls back
+#define BAUD_CONFIRM_TIMEOUT 2
+
+// Number of non-volatile bytes programmed and read by commands 0x07 and 0x08
+#define NV_USER_BYTES 8
+
+// Keys of the non-volatile variables
+#define NV_KEY_TOWER_NUMBER 0x0001
+#define NV_KEY_TOWER_MODE 0x0002
+#define NV_KEY_USER_BYTES 0x0003
+
 // Protocol packet definitions
 #define CMD_STARTUP 0x04
 #define CMD_WRITEBYTE 0x07
@@ -49,8 +66,28 @@
 #define CMD_TWRNUMBER 0x0B
 #define CMD_TIME 0x0C
 #define CMD_TWRMODE 0x0D
+#define CMD_BAUDRATE 0x0E
 #define CMD_ACCELVALUES 0x10
-#define ACK_REQUEST_MASK 0x80
+#define CMD_READBLOCK 0x13
+#define CMD_ACCELSTREAM 0x14
+#define CMD_ACCELDELTA 0x15
+
+// Accelerometer streaming: frames are extended packets of CMD_ACCELSTREAM holding the bus clock time stamp of the first sample
+// (32 bits, least significant byte first), the data rate, the decimation factor, the number of samples, then the XYZ samples.
+// Compressed frames are CMD_ACCELDELTA with the same header, then the samples encoded by the Delta module starting with a keyframe,
+// so that each frame can be decoded on its own; a frame that would not get smaller is sent uncompressed.
+#define STREAM_STOP 0xFF              // Parameter 1 of CMD_ACCELSTREAM that ends streaming
+#define STREAM_HEADER_SIZE 7
+#define STREAM_MAX_SAMPLES 64         // Largest number of samples per frame
+#define STREAM_WATERMARK 24           // Accelerometer FIFO level that starts a read, leaving room for the read latency
+#define STREAM_MAX_DECIMATION 16      // Largest number of samples averaged into one when the link cannot keep up
+#define STREAM_NO_READ 0xFF           // No read from the accelerometer FIFO is in progress
+
+// Address ranges that the block read command may dump
+#define MEM_FLASH_END 0x00100000u        // Program flash, both blocks, from address 0
+#define MEM_SRAM_START 0x1FFF0000u       // SRAM_L and SRAM_U, contiguous
+#define MEM_SRAM_END 0x20010000u
+#define READBLOCK_MAX_LENGTH 4096        // Longest block read, larger reads are paged by the PC so the link is not held for long
 
 //Prototypes
 static void InitThread(void* pData);
@@ -59,26 +96,84 @@ static void AccelReadyThread(void* pData);
 static void I2CReadCompleteThread(void* pData);
 static void RTCThread(void* pData);
 static void PITThread(void* pData);
-static void PacketHandler(void);
+static BOOL StartupHandler(void);
+static BOOL WriteByteHandler(void);
+static BOOL ReadByteHandler(void);
+static BOOL VersionHandler(void);
+static BOOL ProtocolHandler(void);
+static BOOL TowerNumberHandler(void);
+static BOOL TimeHandler(void);
+static BOOL TowerModeHandler(void);
+static BOOL BaudRateHandler(void);
+static BOOL ReadBlockHandler(void);
+static BOOL AccelStreamHandler(void);
+static void StreamSamples(const uint8_t* const samples, const uint8_t count, const uint32_t time);
+static void StreamSend(void);
 static void InitialPackets(void);
 void FTM0Callback(const TFTMChannel* const aFTMChannel);
 
 
 // Variable declarations
 TPacket Packet;                        /*!< Initial packet created */
-volatile TFIFO TxFIFO, RxFIFO;         /*!< Initial FIFOs created */
 volatile TAccelMode Protocol_Mode;     /*!< Initial protocol mode selected */
 
 static TFTMChannel FTMTimer0;          /*!< Stores content of 1 second timer on FTM0 channel 0 */
 
 volatile uint16union_t* NvTowerMode;   /*!< Pointer to tower mode */
 volatile uint16union_t* NvTowerNumber; /*!< Pointer to tower number */
+volatile uint8_t* NvUserBytes;         /*!< Pointer to the bytes programmed and read by commands 0x07 and 0x08 */
 
 static uint16_t TowerMode = 1;         /*!< Initial tower mode */
 static uint16_t TowerNumber = 954;     /*!< Initial tower number, last 4 digits of student number (0x03BA) */
 
 static TAccelData accelerometerValues; /*!< Array to store accelerometer values */
 
+static uint32_t PeripheralSnapshot[PACKET_MAX_PAYLOAD / 4]; /*!< Peripheral registers copied for the block read command */
+
+// Peripheral registers the block read command may read: no side effects on read, and only while the clock gate is on
+typedef struct
+{
+  uint32_t start;                /*!< First register */
+  uint32_t end;                  /*!< Past the last register */
+  volatile const uint32_t* gate; /*!< Clock gate register, NULL if always clocked */
+  uint32_t gateMask;             /*!< Clock gate bit */
+} TReadableRegisters;
+
+static const TReadableRegisters ReadableRegisters[] =
+{
+  {0x40048004u, 0x40048064u, NULL, 0},                         // SIM, SOPT2 to UIDL
+  {0x40037100u, 0x40037140u, &SIM_SCGC6, SIM_SCGC6_PIT_MASK},  // PIT channels
+  {0x40038000u, 0x4003809Cu, &SIM_SCGC6, SIM_SCGC6_FTM0_MASK}, // FTM0, SC to PWMLOAD
+  {0x4003D000u, 0x4003D020u, &SIM_SCGC6, SIM_SCGC6_RTC_MASK},  // RTC, TSR to IER
+  {0x40049000u, 0x40049080u, &SIM_SCGC5, SIM_SCGC5_PORTA_MASK}, // Pin control registers
+  {0x4004A000u, 0x4004A080u, &SIM_SCGC5, SIM_SCGC5_PORTB_MASK},
+  {0x4004B000u, 0x4004B080u, &SIM_SCGC5, SIM_SCGC5_PORTC_MASK},
+  {0x4004C000u, 0x4004C080u, &SIM_SCGC5, SIM_SCGC5_PORTD_MASK},
+  {0x4004D000u, 0x4004D080u, &SIM_SCGC5, SIM_SCGC5_PORTE_MASK},
+  {0x4004E000u, 0x4004E080u, &SIM_SCGC5, SIM_SCGC5_PORTF_MASK}
+};
+
+static const uint32_t StreamPeriod[] = {1250, 2500, 5000, 10000, 20000, 80000, 160000, 640000}; /*!< Sample period in microseconds of each data rate */
+
+static uint8_t StreamBatch[2][ACCEL_FIFO_DEPTH * 3];     /*!< Samples read from the accelerometer FIFO, the buffers are used in turn */
+static uint8_t StreamBatchCount[2];                      /*!< Number of samples in each buffer */
+static uint32_t StreamBatchTime[2];                      /*!< Time stamp of the newest sample in each buffer */
+static uint8_t StreamReadIndex;                          /*!< The buffer the next read from the accelerometer goes into */
+static volatile uint8_t StreamReadBuffer;                /*!< The buffer of the read in progress, STREAM_NO_READ if none */
+static TOutputDataRate StreamRate;                       /*!< Data rate while streaming */
+static uint8_t StreamFrameSamples;                       /*!< Number of samples per frame */
+static uint8_t StreamDecimation;                         /*!< Number of samples averaged into each sample sent */
+static uint8_t StreamFrame[STREAM_HEADER_SIZE + STREAM_MAX_SAMPLES * 3]; /*!< The frame being filled */
+static uint8_t StreamFrameCount;                         /*!< Number of samples in the frame being filled */
+static int16_t StreamSum[3];                             /*!< Sum of the samples being averaged, per axis */
+static uint8_t StreamSumCount;                           /*!< Number of samples in StreamSum */
+static BOOL StreamCompress;                              /*!< TRUE to send compressed frames */
+static uint8_t StreamDeltaFrame[STREAM_HEADER_SIZE + STREAM_MAX_SAMPLES * 3]; /*!< Header and encoded samples of a compressed frame */
+
+static uint32_t BaudRate = BAUD_RATE;  /*!< Last baud rate confirmed by the PC */
+static uint32_t PendingBaudRate = 0;   /*!< Baud rate in use but not yet confirmed by the PC, 0 if none */
+static uint8_t BaudConfirmTimer;       /*!< PIT periods left for the PC to confirm PendingBaudRate */
+
 static uint32_t InitThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));            /*!< The stack for the initialization thread. */
 static uint32_t PacketCheckerThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));   /*!< The stack for the packet checking thread. */
 static uint32_t AccelReadyThreadStack[THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));      /*!< The stack for the accelerometer data ready thread. */
@@ -94,6 +189,7 @@ OS_ECB *Data_Ready_Semaphore;    /*!< Binary semaphore for signaling that data i
 OS_ECB *Read_Complete_Semaphore; /*!< Binary semaphore for signaling that data was read successfully */
 OS_ECB *Update_Clock_Semaphore;  /*!< Binary semaphore for signaling RTC update */
 OS_ECB *PIT_Semaphore;           /*!< Binary semaphore for signaling PIT interrupt */
+static OS_ECB *Stream_Framed_Semaphore; /*!< Binary semaphore for signaling that the samples of the last read have been framed */
 
 
 /*! @brief Waits for a signal to turns the blue LED on, then waits a half a second, then signals for the blue LED to be turned off.
@@ -117,30 +213,61 @@ static void InitThread(void* pData)
 
     LEDs_Init(); // Initialize LED ports
 
+    PIT_Init(CPU_BUS_CLK_HZ); // Initialize PIT0, and PIT1 which time stamps received bytes
+
+    Cmd_Init(); // Dispatch table, modules register their commands from here on
+    Cmd_SetCommit(Flash_Commit); // Sequenced writes are only acknowledged once they are in flash
+
     if (Packet_Init(BAUD_RATE, CPU_BUS_CLK_HZ) && Flash_Init()) // UART and flash initialization
       LEDs_On(LED_ORANGE); // Turn on Orange LED
 
-    if (Flash_AllocateVar((void* )&NvTowerNumber, sizeof(*NvTowerNumber))) // Allocate flash memory
-      Flash_Write16((uint16_t* )NvTowerNumber,TowerNumber); // Program initial tower number to flash
+    Cmd_Register(CMD_STARTUP, StartupHandler);
+    Cmd_Register(CMD_WRITEBYTE, WriteByteHandler);
+    Cmd_Register(CMD_READBYTE, ReadByteHandler);
+    Cmd_Register(CMD_TWRVERSION, VersionHandler);
+    Cmd_Register(CMD_PROTOCOL, ProtocolHandler);
+    Cmd_Register(CMD_TWRNUMBER, TowerNumberHandler);
+    Cmd_Register(CMD_TIME, TimeHandler);
+    Cmd_Register(CMD_TWRMODE, TowerModeHandler);
+    Cmd_Register(CMD_BAUDRATE, BaudRateHandler);
+    Cmd_Register(CMD_READBLOCK, ReadBlockHandler);
+    Cmd_Register(CMD_ACCELSTREAM, AccelStreamHandler);
 
-    if (Flash_AllocateVar((void* )&NvTowerMode, sizeof(*NvTowerMode))) // Allocate flash memory
-      Flash_Write16((uint16_t* )NvTowerMode,TowerMode); // Program initial tower mode to flash
+    UART_SetRxMode(PACKET_UART, UART_RX_DMA); // Receive into DMA buffers, handed over on idle line
+
+    if (Flash_Allocate(NV_KEY_TOWER_NUMBER, sizeof(*NvTowerNumber), sizeof(*NvTowerNumber), (void* )&NvTowerNumber) &&
+        (NvTowerNumber->l == 0xFFFF)) // Allocate flash memory
+      Flash_Write16((uint16_t* )NvTowerNumber,TowerNumber); // Program initial tower number to flash, only if never set
+
+    if (RS485_MULTI_DROP)
+      UART_SetMultiDrop(PACKET_UART, bTRUE, NvTowerNumber->s.Lo); // Only listen to packets addressed to this tower
+
+    if (Flash_Allocate(NV_KEY_TOWER_MODE, sizeof(*NvTowerMode), sizeof(*NvTowerMode), (void* )&NvTowerMode) &&
+        (NvTowerMode->l == 0xFFFF)) // Allocate flash memory
+      Flash_Write16((uint16_t* )NvTowerMode,TowerMode); // Program initial tower mode to flash, only if never set
+
+    Flash_Allocate(NV_KEY_USER_BYTES, NV_USER_BYTES, 1, (void* )&NvUserBytes); // One block, each write replaces a byte of it
+    if (!Flash_Commit()) // Defaults written above
+      LEDs_Off(LED_ORANGE); // Tried again after the first packet
 
     RTC_Init(); // Initialize RTC
     RTC_Set(0,0,0); // Initialize time on tower
 
-    PIT_Init(CPU_BUS_CLK_HZ); // Initialize PIT0
     PIT_Set(500000000*2,bTRUE); // Set PIT0 to a period of 1 second
 
     FTM_Init(); // Initialize FTM
     FTM_Set(&FTMTimer0); // Setup FTM0 timer - channel 0
 
+    Stream_Framed_Semaphore = OS_SemaphoreCreate(1); // No read in progress
+    StreamReadBuffer = STREAM_NO_READ;
+
     Accel_Init(); // Initialize accelerometer
     Accel_SetMode(ACCEL_POLL); // Set initial mode on accelerometer
 
     OS_EnableInterrupts(); // Enable interrupts
 
-    InitialPackets(); // Startup packets
+    if (!RS485_MULTI_DROP)
+      InitialPackets(); // Startup packets
 
     OS_ThreadDelete(OS_PRIORITY_SELF); // Thread not accessed again
   }
@@ -165,105 +292,389 @@ static void PacketCheckerThread(void* pData)
 {
   for (;;)
   {
-    if (Packet_Get()) // Check for received packets from PC
-      PacketHandler(); // Handle received packet
+    Packet_Wait(); // Sleep until data arrives
+
+    while (Packet_Get()) // Check for received packets from PC
+    {
+      LEDs_On(LED_BLUE); // Turn on blue LED
+
+      FTMTimer0.ioType.inputDetection = TIMER_OUTPUT_HIGH; // Start FTM0 timer - channel 0
+      FTM_StartTimer(&FTMTimer0);
+
+      Cmd_Dispatch(); // Handle received packet
+    }
+
+    if (Flash_Commit()) // Program the non-volatile variables changed by this burst, once each
+      LEDs_On(LED_ORANGE);
+    else
+      LEDs_Off(LED_ORANGE); // Flash failed, the changes stay in RAM and are tried again after the next packet
+    Cmd_Flush(); // Acknowledge the sequenced requests handled in this burst, or NAK them if the commit still fails
   }
 }
 
 
-/*! @brief Handles received packets based on received command
+/*! @brief Command 0x04 : special - get startup values.
  *
- *  @return void
+ *  @return BOOL - TRUE if the startup values, version, tower number and tower mode were sent.
+ */
+static BOOL StartupHandler(void)
+{
+  BOOL success;
+
+  success = Packet_Put(CMD_STARTUP,0,0,0) &  // Get startup values (startup values, version, tower number)
+  Packet_Put(CMD_TWRVERSION,'v',1,0) &
+  Packet_Put(CMD_TWRNUMBER,1,NvTowerNumber->s.Lo,NvTowerNumber->s.Hi) &
+  Packet_Put(CMD_TWRMODE,1,NvTowerMode->s.Lo,NvTowerMode->s.Hi);
+  Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
+  return success;
+}
+
+
+/*! @brief Command 0x07 : flash - program byte.
+ *
+ *  @return BOOL - TRUE if the byte was written, or the sector erased for an offset past the sector.
+ *  @note An acknowledged write is programmed before the reply, an unacknowledged one with the rest of the burst by Flash_Commit.
+ */
+static BOOL WriteByteHandler(void)
+{
+  if (Packet_Parameter1 >= NV_USER_BYTES) // If offset is greater than sector range, erase flash
+    return Flash_Erase();
+
+  if (!Flash_Write8(&NvUserBytes[Packet_Parameter1],Packet_Parameter3))
+    return bFALSE;
+
+  if (Packet_Command & CMD_ACK_REQUEST_MASK) // The acknowledgement only reports success once the byte is in flash
+    return Flash_Commit();
+  return bTRUE;
+}
+
+
+/*! @brief Command 0x08 : flash - read byte.
+ *
+ *  @return BOOL - TRUE if the byte was sent.
+ */
+static BOOL ReadByteHandler(void)
+{
+  if (Packet_Parameter1 >= NV_USER_BYTES)
+    return bFALSE;
+
+  return Packet_Put(Packet_Parameter1,0,0,NvUserBytes[Packet_Parameter1]); // Read byte given by offset
+}
+
+
+/*! @brief Command 0x09 : special - get version.
+ *
+ *  @return BOOL - TRUE if the version was sent.
+ */
+static BOOL VersionHandler(void)
+{
+  return Packet_Put(CMD_TWRVERSION,'v',1,0); // Get version
+}
+
+
+/*! @brief Command 0x0A : protocol - get or set mode - synchronous or asynchronous.
+ *
+ *  @return BOOL - TRUE if the protocol mode was sent.
+ */
+static BOOL ProtocolHandler(void)
+{
+  if (Packet_Parameter1 == 1) // Selection to get protocol mode
+    return Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
+
+  if (Packet_Parameter1 == 2) // Selection to set protocol mode
+  {
+    if (Packet_Parameter2 == 0) // Selection for asynchronous mode
+    {
+      Protocol_Mode = ACCEL_POLL;
+      Accel_SetMode(ACCEL_POLL); // Set accelerometer for polling method
+      return Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
+    }
+    else if (Packet_Parameter2 == 1) // Selection for synchronous mode
+    {
+      Protocol_Mode = ACCEL_INT;
+      Accel_SetMode(ACCEL_INT); // Set accelerometer for interrupt method
+      return Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
+    }
+  }
+  return bFALSE;
+}
+
+
+/*! @brief Command 0x0B : special - get or set tower number.
+ *
+ *  @return BOOL - TRUE if the tower number was sent or written.
  */
-static void PacketHandler(void)
+static BOOL TowerNumberHandler(void)
 {
   BOOL success = bFALSE; /*!< Initially success flag set to false */
 
-  LEDs_On(LED_BLUE); // Turn on blue LED
+  if (Packet_Parameter1 == 1) // Selection to get tower number
+    success = Packet_Put(CMD_TWRNUMBER,1,NvTowerNumber->s.Lo,NvTowerNumber->s.Hi); // Tower number
+  else if (Packet_Parameter1 == 2) // Selection to set tower number
+  {
+    success = Flash_Write16((uint16_t* )NvTowerNumber, Packet_Parameter23); // Programmed after the burst by Flash_Commit
+
+    if (success && RS485_MULTI_DROP)
+      success = UART_SetMultiDrop(PACKET_UART, bTRUE, NvTowerNumber->s.Lo); // Answer to the new address from now on
+
+    if (success && (Packet_Command & CMD_ACK_REQUEST_MASK)) // The acknowledgement only reports success once the number is in flash
+      success = Flash_Commit();
+  }
+  return success;
+}
+
+
+/*! @brief Command 0x0C : set time.
+ *
+ *  @return BOOL - Always TRUE.
+ */
+static BOOL TimeHandler(void)
+{
+  RTC_Set(Packet_Parameter1,Packet_Parameter2,Packet_Parameter3); // Set time
+  return bTRUE;
+}
 
-  FTMTimer0.ioType.inputDetection = TIMER_OUTPUT_HIGH; // Start FTM0 timer - channel 0
-  FTM_StartTimer(&FTMTimer0);
 
-  switch (Packet_Command & ~ACK_REQUEST_MASK) // Check command excluding the ACK bit
+/*! @brief Command 0x0D : get or set tower mode.
+ *
+ *  @return BOOL - TRUE if the tower mode was sent or written.
+ */
+static BOOL TowerModeHandler(void)
+{
+  if (Packet_Parameter1 == 1) // Selection to get tower mode
+    return Packet_Put(CMD_TWRMODE,1,NvTowerMode->s.Lo,NvTowerMode->s.Hi);
+
+  if (Packet_Parameter1 == 2) // Selection to set tower mode
   {
-    case CMD_STARTUP: // Command 0x04 : special - get startup values
-      success = Packet_Put(CMD_STARTUP,0,0,0) &  // Get startup values (startup values, version, tower number)
-      Packet_Put(CMD_TWRVERSION,'v',1,0) &
-      Packet_Put(CMD_TWRNUMBER,1,NvTowerNumber->s.Lo,NvTowerNumber->s.Hi) &
-      Packet_Put(CMD_TWRMODE,1,NvTowerMode->s.Lo,NvTowerMode->s.Hi);
-      Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
-      break;
-
-    case CMD_WRITEBYTE: // Command 0x07 : flash - program byte
-      if (Packet_Parameter1 > 7) // If offset is greater than sector range, erase flash
-        success = Flash_Erase();
-      else
-	success = Flash_Write8((uint8_t* )(FLASH_DATA_START + Packet_Parameter1),Packet_Parameter3); // Program received data to flash memory location given by offset
-      break;
+    if (!Flash_Write16((uint16_t* )NvTowerMode, Packet_Parameter23)) // Programmed after the burst by Flash_Commit
+      return bFALSE;
 
-    case CMD_READBYTE: // Command 0x08 : flash - read byte
-      success = Packet_Put(Packet_Parameter1,0,0,_FB(FLASH_DATA_START + Packet_Parameter1)); // Read byte from flash memory location given by offset
-      break;
+    if (Packet_Command & CMD_ACK_REQUEST_MASK) // The acknowledgement only reports success once the mode is in flash
+      return Flash_Commit();
+    return bTRUE;
+  }
+  return bFALSE;
+}
 
-    case CMD_TWRVERSION: // Command 0x09 : special - get version
-      success = Packet_Put(CMD_TWRVERSION,'v',1,0); // Get version
-      break;
 
-    case CMD_PROTOCOL: // Command 0x0A : protocol - get or set mode - synchronous or asynchronous
-      if (Packet_Parameter1 == 1) // Selection to get protocol mode
-        success = Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
-      else if (Packet_Parameter1 == 2) // Selection to set protocol mode
-      {
- 	if (Packet_Parameter2 == 0) // Selection for asynchronous mode
- 	{
- 	  Protocol_Mode = ACCEL_POLL;
- 	  success = Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
- 	  Accel_SetMode(ACCEL_POLL); // Set accelerometer for polling method
- 	}
- 	else if (Packet_Parameter2 == 1) // Selection for synchronous mode
- 	{
- 	  Protocol_Mode = ACCEL_INT;
- 	  success = Packet_Put(CMD_PROTOCOL,1,Protocol_Mode,0); // Protocol mode
- 	  Accel_SetMode(ACCEL_INT); // Set accelerometer for interrupt method
- 	}
-      }
-      break;
+/*! @brief Command 0x0E : get, propose or confirm baud rate (parameter 2 and 3 in units of 100 bits/sec).
+ *
+ *  @return BOOL - TRUE if the baud rate was sent, accepted or confirmed.
+ */
+static BOOL BaudRateHandler(void)
+{
+  BOOL success = bFALSE; /*!< Initially success flag set to false */
 
-    case CMD_TWRNUMBER: // Command 0x0B : special - get or set tower number
-      if (Packet_Parameter1 == 1) // Selection to get tower number
-        success = Packet_Put(CMD_TWRNUMBER,1,NvTowerNumber->s.Lo,NvTowerNumber->s.Hi); // Tower number
-      else if (Packet_Parameter1 == 2) // Selection to set tower number
-      {
-        if (Flash_AllocateVar((void* )&NvTowerNumber, sizeof(*NvTowerNumber))) // Allocate flash memory to store new tower number
-	  success = Flash_Write16((uint16_t* )NvTowerNumber, Packet_Parameter23); // Program new tower number to flash memory
-      }
-      break;
+  if (Packet_Parameter1 == 1) // Selection to get baud rate
+    success = Packet_Put(CMD_BAUDRATE,1,(uint8_t)(BaudRate / 100),(uint8_t)((BaudRate / 100) >> 8));
+  else if (Packet_Parameter1 == 2) // Selection to propose a new baud rate
+  {
+    if (!PendingBaudRate && UART_CheckBaudRate(PACKET_UART, Packet_Parameter23 * 100UL))
+    {
+      uint8_t ackRequest = Packet_Command & CMD_ACK_REQUEST_MASK; /*!< Restored to NAK if the switch does not happen */
 
-    case CMD_TIME: // Command 0x0C : set time
-      RTC_Set(Packet_Parameter1,Packet_Parameter2,Packet_Parameter3); // Set time
-      success = bTRUE;
-      break;
+      Packet_Put(Packet_Command,2,Packet_Parameter2,Packet_Parameter3); // Accept at the old rate, this is also the ACK
+      Packet_Command &= ~CMD_ACK_REQUEST_MASK;
+
+      EnterCritical(); // PITThread checks the pending rate
+      PendingBaudRate = Packet_Parameter23 * 100UL;
+      BaudConfirmTimer = BAUD_CONFIRM_TIMEOUT;
+      ExitCritical();
 
-    case CMD_TWRMODE: // Command 0x0D : get or set tower mode
-      if (Packet_Parameter1 == 1) // Selection to get tower mode
-        success = Packet_Put(CMD_TWRMODE,1,NvTowerMode->s.Lo,NvTowerMode->s.Hi);
-      else if (Packet_Parameter1 == 2) // Selection to set tower mode
+      success = UART_SetBaudRate(PACKET_UART, PendingBaudRate); // Switch once the acceptance has been sent
+      if (!success) // Transmitter never drained, stay at the old rate and refuse the confirmation
       {
-        if (Flash_AllocateVar((void* )&NvTowerMode, sizeof(*NvTowerMode))) // Allocate flash memory to store new tower mode
-          success = Flash_Write16((uint16_t* )NvTowerMode, Packet_Parameter23); // Program new tower mode to flash memory
+        EnterCritical();
+        PendingBaudRate = 0;
+        ExitCritical();
+        Packet_Command |= ackRequest;
       }
-      break;
+    }
+  }
+  else if (Packet_Parameter1 == 3) // Selection to confirm the new baud rate, received at the new rate
+  {
+    EnterCritical();
+    if (PendingBaudRate)
+    {
+      BaudRate = PendingBaudRate; // New rate is now permanent
+      PendingBaudRate = 0;
+      success = bTRUE;
+    }
+    ExitCritical();
+
+    if (success)
+      success = Packet_Put(CMD_BAUDRATE,3,Packet_Parameter2,Packet_Parameter3);
+  }
+  return success;
+}
+
+
+/*! @brief Command 0x13 : read a block of memory (extended packet, payload address and length, 32 bits each, least significant byte first).
+ *
+ *  The reply echoes the request in an extended packet, then streams the block raw followed by its CRC-16/CCITT.
+ *  Flash and SRAM are sent in place by DMA, up to READBLOCK_MAX_LENGTH bytes per request.
+ *  Peripheral registers are snapshot with 32-bit reads first, so the address and length must be multiples of 4
+ *  and the length at most PACKET_MAX_PAYLOAD. Only the registers of ReadableRegisters can be read, while clocked.
+ *  @return BOOL - TRUE if the block was sent.
+ */
+static BOOL ReadBlockHandler(void)
+{
+  uint32_t address, length, i;
+  uint8_t r;
+
+  if (Packet_Length != 8)
+    return bFALSE;
+
+  address = Packet_Payload[0] | (Packet_Payload[1] << 8) | (Packet_Payload[2] << 16) | ((uint32_t)Packet_Payload[3] << 24);
+  length = Packet_Payload[4] | (Packet_Payload[5] << 8) | (Packet_Payload[6] << 16) | ((uint32_t)Packet_Payload[7] << 24);
+
+  if ((length == 0) || (length > READBLOCK_MAX_LENGTH) || (address + length < address)) // Empty, too long or wraps around
+    return bFALSE;
+
+  if ((address + length <= MEM_FLASH_END) ||
+      ((address >= MEM_SRAM_START) && (address + length <= MEM_SRAM_END)))
+    return Packet_PutBlock(CMD_READBLOCK, Packet_Payload, Packet_Length, (const uint8_t* )address, length);
+
+  if ((address & 3) || (length & 3) || (length > sizeof(PeripheralSnapshot)))
+    return bFALSE;
+
+  for (r = 0; r < sizeof(ReadableRegisters) / sizeof(ReadableRegisters[0]); r++)
+  {
+    if ((address < ReadableRegisters[r].start) || (address + length > ReadableRegisters[r].end))
+      continue;
+
+    if (ReadableRegisters[r].gate && !(*ReadableRegisters[r].gate & ReadableRegisters[r].gateMask)) // Would bus fault
+      return bFALSE;
+
+    for (i = 0; i < length / 4; i++) // Registers only tolerate accesses of their own width
+      PeripheralSnapshot[i] = ((volatile const uint32_t* )address)[i];
+
+    return Packet_PutBlock(CMD_READBLOCK, Packet_Payload, Packet_Length, (const uint8_t* )PeripheralSnapshot, length);
+  }
+
+  return bFALSE;
+}
+
+
+/*! @brief Command 0x14 : start accelerometer streaming (parameter 1 the data rate, 0 for 800 Hz to 7 for 1.56 Hz,
+ *         parameter 2 the samples per frame, parameter 3 1 for compressed frames) or stop it (parameter 1 STREAM_STOP), back to polling.
+ *
+ *  @return BOOL - TRUE if streaming was started or stopped.
+ */
+static BOOL AccelStreamHandler(void)
+{
+  if (Packet_Parameter1 == STREAM_STOP)
+  {
+    Protocol_Mode = ACCEL_POLL;
+    Accel_SetMode(ACCEL_POLL);
+    return bTRUE;
+  }
 
-    default: // Command not recognized
-      break;
+  if (RS485_MULTI_DROP || (Packet_Parameter1 > DATE_RATE_1_56_HZ) ||
+      (Packet_Parameter2 == 0) || (Packet_Parameter2 > STREAM_MAX_SAMPLES)) // Frames are unsolicited, not allowed on a shared bus
+    return bFALSE;
+
+  Protocol_Mode = ACCEL_POLL; // Stop the threads using the stream state while it is reset
+  StreamRate = (TOutputDataRate)Packet_Parameter1;
+  StreamFrameSamples = Packet_Parameter2;
+  StreamCompress = (Packet_Parameter3 == 1);
+  StreamDecimation = 1;
+  StreamFrameCount = 0;
+  StreamSumCount = 0;
+
+  Protocol_Mode = ACCEL_STREAM;
+  Accel_SetStream(StreamRate, STREAM_WATERMARK);
+  return bTRUE;
+}
+
+
+/*! @brief Sends the full stream frame, compressed if that makes it smaller.
+ *
+ */
+static void StreamSend(void)
+{
+  TDeltaCodec codec;  /*!< Encoder for the frame */
+  uint16_t rawLength = StreamFrameCount * 3;
+  uint16_t length;    /*!< Length of the encoded samples, 0 if they did not fit */
+  uint8_t i;
+
+  if (StreamCompress)
+  {
+    Delta_Init(&codec, &StreamDeltaFrame[STREAM_HEADER_SIZE], rawLength - 1, 0); // Only worth sending if at least a byte shorter
+    for (i = 0; i < StreamFrameCount; i++)
+      Delta_Encode(&codec, &StreamFrame[STREAM_HEADER_SIZE + i * 3]);
+
+    length = Delta_Finish(&codec);
+    if (length)
+    {
+      for (i = 0; i < STREAM_HEADER_SIZE; i++)
+        StreamDeltaFrame[i] = StreamFrame[i];
+      Packet_PutBulk(CMD_ACCELDELTA, StreamDeltaFrame, STREAM_HEADER_SIZE + length);
+      return;
+    }
   }
 
-  if (Packet_Command & ACK_REQUEST_MASK) // Check for ACK request
+  Packet_PutBulk(CMD_ACCELSTREAM, StreamFrame, STREAM_HEADER_SIZE + rawLength);
+}
+
+
+/*! @brief Adds a batch of samples to the stream, sending each frame as it fills.
+ *
+ *  While the bulk lane transmit FIFO stays more than three quarters full, the decimation doubles at each frame,
+ *  averaging more samples into each one sent; it halves again once the FIFO is below a quarter full.
+ *  No sample is discarded.
+ *  @param samples The XYZ samples, oldest first.
+ *  @param count The number of samples.
+ *  @param time Time stamp of the newest sample.
+ */
+static void StreamSamples(const uint8_t* const samples, const uint8_t count, const uint32_t time)
+{
+  uint32_t period = StreamPeriod[StreamRate] * (CPU_BUS_CLK_HZ / 1000000); /*!< Sample period in time stamp periods */
+  uint32_t sampleTime;
+  uint16_t pending; /*!< Bytes waiting in the transmit FIFO */
+  uint8_t i, axis;
+  uint8_t *sample;
+
+  for (i = 0; i < count; i++)
   {
-    if (!success)
-      Packet_Command &= ~ACK_REQUEST_MASK; // Clear ACK flag if packet handling was unsuccessful
+    if ((StreamFrameCount == 0) && (StreamSumCount == 0)) // First sample of a frame
+    {
+      sampleTime = time - (count - 1 - i) * period;
+      StreamFrame[0] = (uint8_t)sampleTime;
+      StreamFrame[1] = (uint8_t)(sampleTime >> 8);
+      StreamFrame[2] = (uint8_t)(sampleTime >> 16);
+      StreamFrame[3] = (uint8_t)(sampleTime >> 24);
+      StreamFrame[4] = StreamRate;
+      StreamFrame[5] = StreamDecimation;
+    }
 
-    Packet_Put(Packet_Command,Packet_Parameter1,Packet_Parameter2,Packet_Parameter3); // Send packet
+    for (axis = 0; axis < 3; axis++)
+    {
+      if (StreamSumCount == 0)
+        StreamSum[axis] = 0;
+      StreamSum[axis] += (int8_t)samples[i * 3 + axis]; // Two's complement
+    }
+
+    if (++StreamSumCount < StreamDecimation)
+      continue;
+
+    sample = &StreamFrame[STREAM_HEADER_SIZE + StreamFrameCount * 3];
+    for (axis = 0; axis < 3; axis++)
+      sample[axis] = (uint8_t)(StreamSum[axis] / StreamDecimation);
+    StreamSumCount = 0;
+
+    if (++StreamFrameCount < StreamFrameSamples)
+      continue;
+
+    StreamFrame[6] = StreamFrameCount;
+    StreamSend();
+    StreamFrameCount = 0;
+
+    pending = UART_TxPending(PACKET_UART, UART_LANE_BULK);
+    if ((pending > FIFO_SIZE * 3 / 4) && (StreamDecimation < STREAM_MAX_DECIMATION)) // Link is saturated
+      StreamDecimation *= 2;
+    else if ((pending < FIFO_SIZE / 4) && (StreamDecimation > 1)) // Link has caught up
+      StreamDecimation /= 2;
   }
 }
 
@@ -275,12 +686,23 @@ static void PacketHandler(void)
  */
 static void I2CReadCompleteThread(void* pData)
 {
+  uint8_t index; /*!< Stream buffer that has been read */
+
   for (;;)
   {
     OS_SemaphoreWait(Read_Complete_Semaphore,0);
 
+    if (StreamReadBuffer != STREAM_NO_READ) // A batch of samples from the accelerometer FIFO
+    {
+      index = StreamReadBuffer; // Recorded by AccelReadyThread when it started the read
+      if (Protocol_Mode == ACCEL_STREAM) // Otherwise streaming stopped during the read
+        StreamSamples(StreamBatch[index], StreamBatchCount[index], StreamBatchTime[index]);
+      StreamReadBuffer = STREAM_NO_READ;
+      OS_SemaphoreSignal(Stream_Framed_Semaphore); // AccelReadyThread may start the next read
+    }
     // Send accelerometer data at 1.56Hz
-    Packet_Put(CMD_ACCELVALUES,accelerometerValues.bytes[0],accelerometerValues.bytes[1],accelerometerValues.bytes[2]);
+    else if (!RS485_MULTI_DROP)
+      Packet_Put(CMD_ACCELVALUES,accelerometerValues.bytes[0],accelerometerValues.bytes[1],accelerometerValues.bytes[2]);
   }
 }
 
@@ -292,10 +714,30 @@ static void I2CReadCompleteThread(void* pData)
  */
 static void AccelReadyThread(void* pData)
 {
+  uint8_t count; /*!< Number of samples in the accelerometer FIFO */
+
   for (;;)
   {
     OS_SemaphoreWait(Data_Ready_Semaphore,0);
 
+    if (Protocol_Mode == ACCEL_STREAM) // FIFO watermark reached
+    {
+      OS_SemaphoreWait(Stream_Framed_Semaphore,0); // The samples of the previous read have been framed
+      count = Accel_FIFOCount();
+      if (count)
+      {
+        StreamBatchTime[StreamReadIndex] = PIT_Timestamp(); // Time of the newest sample, to within one sample period
+        StreamBatchCount[StreamReadIndex] = count;
+        StreamReadBuffer = StreamReadIndex; // I2CReadCompleteThread frames the samples of this buffer
+        Accel_ReadSamples(StreamBatch[StreamReadIndex], count);
+        StreamReadIndex ^= 1;
+      }
+      else
+        OS_SemaphoreSignal(Stream_Framed_Semaphore); // Nothing to read
+      LEDs_Toggle(LED_GREEN);
+      continue;
+    }
+
     Accel_ReadXYZ(accelerometerValues.bytes); // Collect accelerometer data
     LEDs_Toggle(LED_GREEN); // Turn on green LED
   }
@@ -315,19 +757,34 @@ static void PITThread(void* pData)
 
     static TAccelData lastAccelerometerValues; /*!< Array to store previous accelerometer data */
     uint8_t axisCount; /*!< Variables to store axis number */
+    BOOL baudTimeout = bFALSE; /*!< TRUE if the baud rate has to fall back */
 
     if (PIT_TFLG0 & PIT_TFLG_TIF_MASK) // Check if timeout has occurred (1 second) - 1Hz frequency
     {
       PIT_TFLG0 |= PIT_TFLG_TIF_MASK; // Clear timer interrupt flag
+
+      EnterCritical(); // BaudRateHandler sets and confirms the pending rate
+      if (PendingBaudRate && (--BaudConfirmTimer == 0)) // PC never confirmed the new rate
+      {
+        PendingBaudRate = 0;
+        baudTimeout = bTRUE;
+      }
+      ExitCritical();
+
+      if (baudTimeout)
+      {
+        baudTimeout = !UART_SetBaudRate(PACKET_UART, BaudRate); // Fall back to the last confirmed rate, again next period if the transmitter is busy
+      }
       if (Protocol_Mode == ACCEL_POLL) // Only read accelerometer if in polling mode
       {
         Accel_ReadXYZ(accelerometerValues.bytes); // Collect accelerometer data
         LEDs_Toggle(LED_GREEN); // Toggle green LED
 
         // Send accelerometer data every second only if there is a difference from last time
-        if ((lastAccelerometerValues.bytes[0] != accelerometerValues.bytes[0]) ||
-            (lastAccelerometerValues.bytes[1] != accelerometerValues.bytes[1]) ||
-            (lastAccelerometerValues.bytes[2] != accelerometerValues.bytes[2]))
+        if (!RS485_MULTI_DROP &&
+            ((lastAccelerometerValues.bytes[0] != accelerometerValues.bytes[0]) ||
+             (lastAccelerometerValues.bytes[1] != accelerometerValues.bytes[1]) ||
+             (lastAccelerometerValues.bytes[2] != accelerometerValues.bytes[2])))
           Packet_Put(CMD_ACCELVALUES,accelerometerValues.bytes[0],accelerometerValues.bytes[1],accelerometerValues.bytes[2]);
 
         for (axisCount=0; axisCount < 3; axisCount++) // Transfer data from new data array to old data array
@@ -354,7 +811,8 @@ static void RTCThread(void* pData)
     uint8_t hours, minutes, seconds; /*!< Variables to store current time */
 
     RTC_Get(&hours,&minutes,&seconds); // Get current time each second
-    Packet_Put(CMD_TIME,hours,minutes,seconds); // Update time in PC
+    if (!RS485_MULTI_DROP)
+      Packet_Put(CMD_TIME,hours,minutes,seconds); // Update time in PC
     LEDs_Toggle(LED_YELLOW); // Toggle yellow LED
   }
 }
@@ -19,81 +19,318 @@
 #include "PE_Types.h"
 #include "packet.h"
 #include "UART.h"
+#include "CRC.h"
+#include "Cmd.h"
+
+
+// Default gap between the bytes of one packet after which a partial packet is discarded, in microseconds
+#define PACKET_DEFAULT_TIMEOUT 20000
+
+// Command to get a link error counter, and its selections in parameter 1
+#define CMD_UARTSTATS 0x0F
+#define UART_STAT_OVERRUNS 0
+#define UART_STAT_NOISE 1
+#define UART_STAT_FRAMING 2
+#define UART_STAT_PARITY 3
+#define UART_STAT_DROPPED 4
+#define UART_STAT_RESYNCS 5
+
+// Variable declarations
+static uint32_t ModuleClkMHz;     /*!< Module clock value in MHz, the rate of the PIT time stamps */
+static uint32_t PacketTimeout;    /*!< Largest gap between the bytes of one packet in PIT time stamp periods, 0 for no limit */
+static uint32_t LastByteTime;     /*!< Time stamp of the last byte received */
+static uint32_t LineErrors;       /*!< UART line error count when the last byte was received */
+
+static uint8_t Window[PACKET_NB_BYTES]; /*!< The last bytes received, a packet candidate once full */
+static uint8_t WindowIndex;       /*!< Position of the oldest byte in the window, where the next byte goes */
+static uint8_t WindowCount;       /*!< Number of bytes in the window */
+static uint8_t WindowXOR;         /*!< XOR of the bytes in the window, 0 for a valid packet */
+static BOOL Hunting;              /*!< TRUE while sliding through bytes after a checksum failure */
+static uint32_t ResyncCount;      /*!< Number of times packet alignment was lost */
+
+static uint8_t ExtendedHeader[PACKET_NB_BYTES]; /*!< Header of the extended packet being received, covered by the CRC */
+static uint16_t ExtendedLength;   /*!< Payload length of the extended packet being received, 0 if none */
+static uint16_t ExtendedCount;    /*!< Number of payload and CRC bytes received so far */
+static uint8_t ExtendedCRC[2];    /*!< Received CRC, least significant byte first */
+
+static OS_ECB *TxSemaphore[UART_NB_LANES]; /*!< Mutex per transmit lane that keeps the bytes of one packet together */
+
+uint8_t Packet_Payload[PACKET_MAX_PAYLOAD]; /*!< Payload of the last extended packet */
+uint16_t Packet_Length;           /*!< Payload length of the last packet, 0 for a plain 5-byte packet */
+
+// Prototypes
+static void ResetFrame(void);
+static void PutExtended(const TUARTLane lane, const uint8_t command, const uint8_t* const payload, const uint16_t length, const BOOL endOfFrame);
+static BOOL UARTStatsHandler(void);
 
 
 BOOL Packet_Init(const uint32_t baudRate, const uint32_t moduleClk)
 {
-  return UART_Init(baudRate, moduleClk); // Initialize UART2
+  if (!UART_Init(PACKET_UART, baudRate, moduleClk, PACKET_UART_THREAD_PRIORITY)) // Initialize the packet UART
+    return bFALSE;
+
+  ModuleClkMHz = moduleClk / 1000000; // The PIT runs from the same bus clock
+  Packet_SetTimeout(PACKET_DEFAULT_TIMEOUT);
+  ResetFrame();
+
+  TxSemaphore[UART_LANE_CONTROL] = OS_SemaphoreCreate(1); // One writer at a time per lane
+  TxSemaphore[UART_LANE_BULK] = OS_SemaphoreCreate(1);
+  CRC_Init(); // Extended packets are protected by a CRC
+  Cmd_Register(CMD_UARTSTATS, UARTStatsHandler);
+
+  UART_SetRxWakeLevel(PACKET_UART, PACKET_NB_BYTES); // Only wake the packet thread once a whole packet may have arrived
+  return bTRUE;
+}
+
+
+/*! @brief Command 0x0F : get a link error counter, saturated to 16 bits.
+ *
+ *  @return BOOL - TRUE if the counter was sent.
+ */
+static BOOL UARTStatsHandler(void)
+{
+  TUARTStats stats; /*!< Snapshot of the packet UART counters */
+  uint32_t count;   /*!< The selected counter */
+
+  UART_GetStats(PACKET_UART, &stats);
+  switch (Packet_Parameter1)
+  {
+    case UART_STAT_OVERRUNS: count = stats.overruns;      break;
+    case UART_STAT_NOISE:    count = stats.noiseErrors;   break;
+    case UART_STAT_FRAMING:  count = stats.framingErrors; break;
+    case UART_STAT_PARITY:   count = stats.parityErrors;  break;
+    case UART_STAT_DROPPED:  count = stats.rxDropped;     break;
+    case UART_STAT_RESYNCS:  count = ResyncCount;         break;
+    default:                 return bFALSE;
+  }
+
+  if (count > 0xFFFF)
+    count = 0xFFFF;
+  return Packet_Put(CMD_UARTSTATS,Packet_Parameter1,(uint8_t)count,(uint8_t)(count >> 8));
+}
+
+
+void Packet_SetTimeout(const uint32_t timeout)
+{
+  PacketTimeout = timeout * ModuleClkMHz;
+}
+
+
+void Packet_Wait(void)
+{
+  UART_WaitForData(PACKET_UART);
+}
+
+
+uint32_t Packet_ResyncCount(void)
+{
+  return ResyncCount;
+}
+
+
+/*! @brief Discards the packet being assembled.
+ *
+ */
+static void ResetFrame(void)
+{
+  WindowCount = 0;
+  WindowXOR = 0;
+  ExtendedLength = 0;
 }
 
 
 BOOL Packet_Get(void)
 {
-  uint8_t PacketChecksum = 0; /*!< Checksum of bytes */
-  static uint8_t state = 0;   /*!< Current state of the state machine */
+  uint8_t data;   /*!< The byte being processed */
+  uint32_t now;   /*!< Arrival time stamp of the byte */
+  uint32_t errors;
+  uint16_t crc;   /*!< CRC calculated over an extended packet */
+  uint8_t i;
 
-  while (1)
+  while (UART_InChars(PACKET_UART, &data, 1)) // Consume what has arrived, never wait
   {
-    switch (state) // State machine
+    now = UART_RxTimestamp(PACKET_UART); // When it arrived, however late this thread gets to it
+    if ((WindowCount || ExtendedLength) && PacketTimeout && (now - LastByteTime > PacketTimeout)) // Sender gave up on the partial packet
+      ResetFrame();
+    LastByteTime = now;
+
+    errors = UART_LineErrors(PACKET_UART);
+    if (errors != LineErrors) // Bytes were lost on the line, the partial packet cannot be trusted
+    {
+      LineErrors = errors;
+      ResetFrame();
+    }
+
+    if (ExtendedLength) // Payload and CRC of an extended packet
     {
-    case 0:
-      if (UART_InChar(&Packet_Command)) // Get command byte from RxFIFO
-        state = 1; // If successful move to next state
-      break;
-
-    case 1:
-      if (UART_InChar(&Packet_Parameter1)) // Get parameter 1 byte from RxFIFO
-      	state = 2; // If successful move to next state
-      break;
-
-    case 2:
-      if (UART_InChar(&Packet_Parameter2)) // Get parameter 2 from RxFIFO
-      	state = 3; // If successful move to next state
-      break;
-
-    case 3:
-      if (UART_InChar(&Packet_Parameter3)) // Get parameter 3 from RxFIFO
-      	state = 4; // If successful move to next state
-      break;
-
-    case 4:
-      if (UART_InChar(&PacketChecksum)) // Get the checksum from RxFIFO
-        state = 5; // If successful move to next state
-      break;
-
-    case 5:
-      if ((Packet_Command ^ Packet_Parameter1 ^ Packet_Parameter2 ^ Packet_Parameter3) == PacketChecksum)
+      if (ExtendedCount < ExtendedLength)
+        Packet_Payload[ExtendedCount] = data;
+      else
+        ExtendedCRC[ExtendedCount - ExtendedLength] = data;
+
+      if (++ExtendedCount < ExtendedLength + sizeof(ExtendedCRC))
+        continue;
+
+      Packet_Length = ExtendedLength;
+      ExtendedLength = 0; // Back to looking for headers whatever the outcome
+
+      crc = CRC_Calculate(CRC_Calculate(CRC_SEED, ExtendedHeader, PACKET_NB_BYTES), Packet_Payload, Packet_Length);
+      if (crc != (ExtendedCRC[0] | (ExtendedCRC[1] << 8)))
       {
-	state = 0; // Valid packet received, return to initial state
-	PacketChecksum = 0; // Initialize checksum
-	return bTRUE; // Exit state machine
+        ResyncCount++; // Payload is corrupt, hunt for the next packet
+        continue;
       }
-      else
+
+      for (i = 0; i < PACKET_NB_BYTES; i++)
+        Packet.bytes[i] = ExtendedHeader[i];
+      Packet_Command = ExtendedHeader[1]; // Present the payload under its own command
+      Packet_Parameter1 = 0;
+      return bTRUE;
+    }
+
+    if (WindowCount == PACKET_NB_BYTES) // Slide, the oldest byte drops out of the XOR
+      WindowXOR ^= Window[WindowIndex];
+    else
+      WindowCount++;
+
+    Window[WindowIndex] = data;
+    WindowXOR ^= data;
+    if (++WindowIndex == PACKET_NB_BYTES)
+      WindowIndex = 0;
+
+    if (WindowCount < PACKET_NB_BYTES) // Wait for the rest of the packet
+      continue;
+
+    if (WindowXOR == 0) // Checksum is the XOR of the other four bytes
+    {
+      for (i = 0; i < PACKET_NB_BYTES; i++) // Oldest byte first
+      {
+        Packet.bytes[i] = Window[WindowIndex];
+        if (++WindowIndex == PACKET_NB_BYTES)
+          WindowIndex = 0;
+      }
+
+      WindowCount = 0; // Valid packet received, start afresh with the next byte
+      WindowXOR = 0;
+      Hunting = bFALSE;
+
+      if ((Packet_Command == PACKET_EXTENDED) && (Packet_Parameter23 >= 1) && (Packet_Parameter23 <= PACKET_MAX_PAYLOAD))
       {
-	Packet_Command = Packet_Parameter1; // Checksum does not add up, right shift bytes
-	Packet_Parameter1 = Packet_Parameter2;
-	Packet_Parameter2 = Packet_Parameter3;
-	Packet_Parameter3 = PacketChecksum;
-	state = 4; // Go back to previous state to re-check
+        for (i = 0; i < PACKET_NB_BYTES; i++) // Header of an extended packet, the payload follows
+          ExtendedHeader[i] = Packet.bytes[i];
+        ExtendedLength = Packet_Parameter23;
+        ExtendedCount = 0;
+        continue;
       }
-      break;
+
+      Packet_Length = 0;
+      return bTRUE;
+    }
+
+    if (!Hunting) // Lost alignment, the following bytes are tried one at a time
+    {
+      Hunting = bTRUE;
+      ResyncCount++;
     }
   }
+
+  return bFALSE; // No complete packet yet
 }
 
+
 BOOL Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
 {
-  EnterCritical(); // Start of critical section
-  UART_OutChar(command); // Put the packet, byte by byte into TxFIFO
-  UART_OutChar(parameter1);
-  UART_OutChar(parameter2);
-  UART_OutChar(parameter3);
-  UART_OutChar(command^parameter1^parameter2^parameter3);
-  ExitCritical(); // End of critical section
+  uint8_t packet[PACKET_NB_BYTES] = {command, parameter1, parameter2, parameter3, command^parameter1^parameter2^parameter3};
+
+  OS_SemaphoreWait(TxSemaphore[UART_LANE_CONTROL], 0); // Keep the packet together
+  UART_OutChars(PACKET_UART, packet, PACKET_NB_BYTES); // Put the packet into TxFIFO
+  OS_SemaphoreSignal(TxSemaphore[UART_LANE_CONTROL]);
   return bTRUE; // Packet successfully placed in TxFIFO
 }
 
 
+/*! @brief Sends an extended packet.
+ *
+ *  @param lane The transmit lane.
+ *  @param command The command.
+ *  @param payload A pointer to the payload.
+ *  @param length The payload length, from 1 to PACKET_MAX_PAYLOAD.
+ *  @param endOfFrame TRUE if nothing else follows the packet in the same frame.
+ *  @note Assumes that the caller holds the lane's TxSemaphore and has checked the length.
+ */
+static void PutExtended(const TUARTLane lane, const uint8_t command, const uint8_t* const payload, const uint16_t length, const BOOL endOfFrame)
+{
+  uint8_t header[PACKET_NB_BYTES]; /*!< A plain packet announcing the payload */
+  uint8_t crc[2];                  /*!< CRC over header and payload, least significant byte first */
+  uint16_t value;
+
+  header[0] = PACKET_EXTENDED;
+  header[1] = command;
+  header[2] = (uint8_t)length;
+  header[3] = (uint8_t)(length >> 8);
+  header[4] = header[0] ^ header[1] ^ header[2] ^ header[3];
+
+  value = CRC_Calculate(CRC_Calculate(CRC_SEED, header, PACKET_NB_BYTES), payload, length);
+  crc[0] = (uint8_t)value;
+  crc[1] = (uint8_t)(value >> 8);
+
+  UART_OutLane(PACKET_UART, lane, header, PACKET_NB_BYTES, bFALSE);
+  UART_OutLane(PACKET_UART, lane, payload, length, bFALSE);
+  UART_OutLane(PACKET_UART, lane, crc, sizeof(crc), endOfFrame);
+}
+
+
+BOOL Packet_PutExtended(const uint8_t command, const uint8_t* const payload, const uint16_t length)
+{
+  if ((length == 0) || (length > PACKET_MAX_PAYLOAD))
+    return bFALSE;
+
+  OS_SemaphoreWait(TxSemaphore[UART_LANE_CONTROL], 0); // Keep the packet together
+  PutExtended(UART_LANE_CONTROL, command, payload, length, bTRUE);
+  OS_SemaphoreSignal(TxSemaphore[UART_LANE_CONTROL]);
+  return bTRUE;
+}
+
+
+BOOL Packet_PutBulk(const uint8_t command, const uint8_t* const payload, const uint16_t length)
+{
+  if ((length == 0) || (length > PACKET_MAX_PAYLOAD))
+    return bFALSE;
+
+  OS_SemaphoreWait(TxSemaphore[UART_LANE_BULK], 0); // Keep the packet together
+  PutExtended(UART_LANE_BULK, command, payload, length, bTRUE);
+  OS_SemaphoreSignal(TxSemaphore[UART_LANE_BULK]);
+  return bTRUE;
+}
+
+
+BOOL Packet_PutBlock(const uint8_t command, const uint8_t* const header, const uint16_t headerLength, const uint8_t* const data, const uint32_t length)
+{
+  uint8_t crc[2];   /*!< CRC over the block, least significant byte first */
+  uint16_t value = CRC_SEED;
+  uint32_t offset;
+  uint16_t count;
+
+  if ((headerLength == 0) || (headerLength > PACKET_MAX_PAYLOAD) || (length == 0))
+    return bFALSE;
+
+  for (offset = 0; offset < length; offset += count) // A piece at a time, CRC_Calculate disables interrupts
+  {
+    count = (length - offset > PACKET_MAX_PAYLOAD) ? PACKET_MAX_PAYLOAD : (uint16_t)(length - offset);
+    value = CRC_Calculate(value, &data[offset], count);
+  }
+  crc[0] = (uint8_t)value;
+  crc[1] = (uint8_t)(value >> 8);
+
+  OS_SemaphoreWait(TxSemaphore[UART_LANE_BULK], 0); // Keep header, block and CRC together
+  PutExtended(UART_LANE_BULK, command, header, headerLength, bFALSE); // One frame up to the block CRC
+  UART_OutBlock(PACKET_UART, data, length); // DMA reads the block in place
+  UART_OutLane(PACKET_UART, UART_LANE_BULK, crc, sizeof(crc), bTRUE);
+  OS_SemaphoreSignal(TxSemaphore[UART_LANE_BULK]);
+  return bTRUE;
+}
+
+
 /*!
  * @}
 */
@@ -13,10 +13,20 @@
 
 // New types
 #include "types.h"
+#include "UART.h"
+
+// The UART carrying the packets and the priority of its receive thread
+#define PACKET_UART UART_INSTANCE_2
+#define PACKET_UART_THREAD_PRIORITY 1
 
 // Packet structure
 #define PACKET_NB_BYTES 5
 
+// Extended packets: a plain packet with this command, the real command in parameter 1 and the payload length in parameters 2 and 3,
+// followed by the payload and a CRC-16/CCITT of header and payload, least significant byte first
+#define PACKET_EXTENDED 0x7F
+#define PACKET_MAX_PAYLOAD 256
+
 #pragma pack(push)
 #pragma pack(1)
 
@@ -61,6 +71,9 @@ typedef union
 
 extern TPacket Packet;
 
+extern uint8_t Packet_Payload[PACKET_MAX_PAYLOAD]; /*!< Payload of the last extended packet. */
+extern uint16_t Packet_Length;                     /*!< Payload length of the last packet, 0 for a plain packet. */
+
 // Acknowledgment bit mask
 extern const uint8_t PACKET_ACK_MASK;
 
@@ -69,19 +82,80 @@ extern const uint8_t PACKET_ACK_MASK;
  *  @param baudRate The desired baud rate in bits/sec.
  *  @param moduleClk The module clock rate in Hz.
  *  @return BOOL - TRUE if the packet module was successfully initialized.
+ *  @note Assumes that Cmd_Init has been called, the link statistics command is registered here.
  */
 BOOL Packet_Init(const uint32_t baudRate, const uint32_t moduleClk);
 
+/*! @brief Sets the largest gap allowed between the bytes of one packet.
+ *
+ *  A partial packet is discarded if the next byte arrives later than this.
+ *  @param timeout The gap in microseconds, 0 for no limit.
+ *  @note Assumes that Packet_Init has been called. Packet_Init sets 20 ms.
+ */
+void Packet_SetTimeout(const uint32_t timeout);
+
+/*! @brief Waits until received data is available for Packet_Get.
+ *
+ *  @note Assumes that Packet_Init has been called. Must not be called from an ISR.
+ */
+void Packet_Wait(void);
+
 /*! @brief Attempts to get a packet from the received data.
  *
+ *  Consumes the bytes that have already arrived and returns as soon as a packet is complete or no bytes are left.
+ *  A partial packet is kept for the next call.
+ *  For an extended packet Packet_Command holds the real command, Packet_Parameter23 and Packet_Length the payload length,
+ *  and Packet_Payload the payload. Packet_Length is 0 for a plain packet.
  *  @return BOOL - TRUE if a valid packet was received.
+ *  @note Assumes that Packet_Init and PIT_Init have been called.
  */
 BOOL Packet_Get(void);
 
+/*! @brief Gets the number of times the packet alignment was lost.
+ *
+ *  A resynchronization starts at a checksum failure and ends at the next valid packet.
+ *  @return uint32_t - The number of resynchronizations since Packet_Init.
+ */
+uint32_t Packet_ResyncCount(void);
+
 /*! @brief Builds a packet and places it in the transmit FIFO buffer.
  *
  *  @return BOOL - TRUE if a valid packet was sent.
+ *  @note Must not be called from an ISR.
  */
 BOOL Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
 
+/*! @brief Builds an extended packet and places it in the transmit FIFO buffer, on the control lane with the plain packets.
+ *
+ *  @param command The command.
+ *  @param payload A pointer to the payload.
+ *  @param length The payload length, from 1 to PACKET_MAX_PAYLOAD.
+ *  @return BOOL - TRUE if the packet was sent, FALSE if the length is out of range.
+ *  @note Must not be called from an ISR.
+ */
+BOOL Packet_PutExtended(const uint8_t command, const uint8_t* const payload, const uint16_t length);
+
+/*! @brief Builds an extended packet and places it in the bulk lane transmit FIFO, sent only while no control packets wait.
+ *
+ *  @param command The command.
+ *  @param payload A pointer to the payload.
+ *  @param length The payload length, from 1 to PACKET_MAX_PAYLOAD.
+ *  @return BOOL - TRUE if the packet was sent, FALSE if the length is out of range.
+ *  @note Must not be called from an ISR.
+ */
+BOOL Packet_PutBulk(const uint8_t command, const uint8_t* const payload, const uint16_t length);
+
+/*! @brief Sends an extended packet on the bulk lane followed by a raw block of memory and a CRC-16/CCITT of the block, least significant byte first.
+ *
+ *  The block is streamed by DMA straight from memory, without packetization, and nothing else is sent in between.
+ *  @param command The command of the extended packet that announces the block.
+ *  @param header A pointer to the payload of the extended packet, which should tell the receiver the block length.
+ *  @param headerLength The payload length, from 1 to PACKET_MAX_PAYLOAD.
+ *  @param data A pointer to the block, in memory the DMA can read such as flash or SRAM.
+ *  @param length The block length.
+ *  @return BOOL - TRUE if the block was sent, FALSE if a length is out of range.
+ *  @note Must not be called from an ISR.
+ */
+BOOL Packet_PutBlock(const uint8_t command, const uint8_t* const header, const uint16_t headerLength, const uint8_t* const data, const uint32_t length);
+
 #endif